@@ -0,0 +1,87 @@
+/*
+ * gf-tools
+ * Copyright (C) 2020 Julien Bernard
+ *
+ * This software is provided 'as-is', without any express or implied
+ * warranty.  In no event will the authors be held liable for any damages
+ * arising from the use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ *    claim that you wrote the original software. If you use this software
+ *    in a product, an acknowledgment in the product documentation would be
+ *    appreciated but is not required.
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ *    misrepresented as being the original software.
+ * 3. This notice may not be removed or altered from any source distribution.
+ */
+#include "TilesetArena.h"
+
+#include <algorithm>
+
+namespace gftools {
+
+  namespace {
+
+    thread_local std::pmr::memory_resource *g_current = nullptr;
+
+  }
+
+  TileArena::TileArena(std::size_t initialSize)
+  : m_buffer(std::max(initialSize, std::size_t(1)), &m_upstream)
+  , m_allocationCount(0)
+  {
+  }
+
+  std::pmr::memory_resource *TileArena::getCurrent() {
+    if (g_current != nullptr) {
+      return g_current;
+    }
+
+    return std::pmr::get_default_resource();
+  }
+
+  void *TileArena::do_allocate(std::size_t bytes, std::size_t alignment) {
+    ++m_allocationCount;
+    return m_buffer.allocate(bytes, alignment);
+  }
+
+  void TileArena::do_deallocate([[maybe_unused]] void *pointer, [[maybe_unused]] std::size_t bytes, [[maybe_unused]] std::size_t alignment) {
+    // released with the arena
+  }
+
+  bool TileArena::do_is_equal(const std::pmr::memory_resource& other) const noexcept {
+    return this == &other;
+  }
+
+  void *TileArena::CountingResource::do_allocate(std::size_t bytes, std::size_t alignment) {
+    ++blockCount;
+    return std::pmr::new_delete_resource()->allocate(bytes, alignment);
+  }
+
+  void TileArena::CountingResource::do_deallocate(void *pointer, std::size_t bytes, std::size_t alignment) {
+    std::pmr::new_delete_resource()->deallocate(pointer, bytes, alignment);
+  }
+
+  bool TileArena::CountingResource::do_is_equal(const std::pmr::memory_resource& other) const noexcept {
+    return this == &other;
+  }
+
+  /*
+   * TileArena::Scope
+   */
+
+  TileArena::Scope::Scope(TileArena& arena)
+  : m_previous(g_current)
+  {
+    g_current = &arena;
+  }
+
+  TileArena::Scope::~Scope() {
+    g_current = m_previous;
+  }
+
+}
@@ -0,0 +1,83 @@
+/*
+ * gf-tools
+ * Copyright (C) 2020 Julien Bernard
+ *
+ * This software is provided 'as-is', without any express or implied
+ * warranty.  In no event will the authors be held liable for any damages
+ * arising from the use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ *    claim that you wrote the original software. If you use this software
+ *    in a product, an acknowledgment in the product documentation would be
+ *    appreciated but is not required.
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ *    misrepresented as being the original software.
+ * 3. This notice may not be removed or altered from any source distribution.
+ */
+#ifndef TILESET_ARENA_H
+#define TILESET_ARENA_H
+
+#include <cstddef>
+#include <memory_resource>
+
+namespace gftools {
+
+  // monotonic memory for the tiles of a tileset, everything is released at once when the arena is destroyed
+  class TileArena : public std::pmr::memory_resource {
+  public:
+    TileArena(std::size_t initialSize);
+
+    TileArena(const TileArena&) = delete;
+    TileArena& operator=(const TileArena&) = delete;
+
+    // number of buffers served by the arena
+    std::size_t getAllocationCount() const {
+      return m_allocationCount;
+    }
+
+    // number of blocks requested by the arena to the heap
+    std::size_t getBlockCount() const {
+      return m_upstream.blockCount;
+    }
+
+    // the memory for the tiles created in the current thread, the arena of the innermost scope or the heap
+    static std::pmr::memory_resource *getCurrent();
+
+    class Scope {
+    public:
+      Scope(TileArena& arena);
+      ~Scope();
+
+      Scope(const Scope&) = delete;
+      Scope& operator=(const Scope&) = delete;
+
+    private:
+      std::pmr::memory_resource *m_previous;
+    };
+
+  private:
+    void *do_allocate(std::size_t bytes, std::size_t alignment) override;
+    void do_deallocate(void *pointer, std::size_t bytes, std::size_t alignment) override;
+    bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override;
+
+  private:
+    struct CountingResource : std::pmr::memory_resource {
+      std::size_t blockCount = 0;
+
+      void *do_allocate(std::size_t bytes, std::size_t alignment) override;
+      void do_deallocate(void *pointer, std::size_t bytes, std::size_t alignment) override;
+      bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override;
+    };
+
+    CountingResource m_upstream;
+    std::pmr::monotonic_buffer_resource m_buffer;
+    std::size_t m_allocationCount;
+  };
+
+}
+
+#endif // TILESET_ARENA_H
@@ -0,0 +1,512 @@
+/*
+ * gf-tools
+ * Copyright (C) 2020 Julien Bernard
+ *
+ * This software is provided 'as-is', without any express or implied
+ * warranty.  In no event will the authors be held liable for any damages
+ * arising from the use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ *    claim that you wrote the original software. If you use this software
+ *    in a product, an acknowledgment in the product documentation would be
+ *    appreciated but is not required.
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ *    misrepresented as being the original software.
+ * 3. This notice may not be removed or altered from any source distribution.
+ */
+#include "TilesetAutotiler.h"
+
+#include <cassert>
+#include <cstdlib>
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <utility>
+
+#include <gf/Log.h>
+#include <gf/VectorOps.h>
+
+#include "TilesetParallel.h"
+
+namespace gftools {
+
+  namespace {
+
+    constexpr int PaintBandHeight = 64;
+
+    // the value of the attribute in an element, e.g. <wangtile tileid="3" .../>
+    bool findAttribute(const std::string& element, const char *name, std::string& value) {
+      std::string pattern = std::string(" ") + name + "=\"";
+      std::size_t start = element.find(pattern);
+
+      if (start == std::string::npos) {
+        return false;
+      }
+
+      start += pattern.size();
+      std::size_t end = element.find('"', start);
+
+      if (end == std::string::npos) {
+        return false;
+      }
+
+      value = element.substr(start, end - start);
+      return true;
+    }
+
+    bool findIntAttribute(const std::string& element, const char *name, int& value) {
+      std::string text;
+
+      if (!findAttribute(element, name, text)) {
+        return false;
+      }
+
+      char *end = nullptr;
+      value = static_cast<int>(std::strtol(text.c_str(), &end, 10));
+      return end != text.c_str();
+    }
+
+    // the next element with this name, from the offset
+    bool findElement(const std::string& text, const char *name, std::size_t& offset, std::size_t limit, std::string& element) {
+      std::string pattern = std::string("<") + name;
+
+      for (;;) {
+        std::size_t start = text.find(pattern, offset);
+
+        if (start == std::string::npos || start >= limit) {
+          return false;
+        }
+
+        std::size_t end = text.find('>', start);
+
+        if (end == std::string::npos) {
+          return false;
+        }
+
+        offset = end + 1;
+
+        char next = text[start + pattern.size()];
+
+        if (next == ' ' || next == '/' || next == '>' || next == '\n' || next == '\t') {
+          element = text.substr(start, end - start);
+          std::replace(element.begin(), element.end(), '\n', ' ');
+          std::replace(element.begin(), element.end(), '\t', ' ');
+          return true;
+        }
+      }
+    }
+
+  }
+
+  Autotiler::Autotiler() {
+    reset(0);
+  }
+
+  bool Autotiler::reset(int terrainCount) {
+    m_tiles.clear();
+    m_exact.clear();
+    m_exactTiles.clear();
+    m_terrainTiles.clear();
+    m_fallbackTiles.clear();
+
+    if (terrainCount < 0 || terrainCount > MaxTerrainCount) {
+      gf::Log::error("Too many terrains for the autotiler: %i\n", terrainCount);
+      // the tables of no terrain, so that the lookups stay valid
+      reset(0);
+      return false;
+    }
+
+    m_terrainCount = terrainCount;
+
+    if (isFlat()) {
+      std::size_t base = static_cast<std::size_t>(m_terrainCount) + 1;
+      m_tiles.resize(base * base * base * base, NoTile);
+      m_exact.resize(m_tiles.size(), 0);
+    }
+
+    m_terrainTiles.resize(static_cast<std::size_t>(m_terrainCount) + 1, NoTile);
+    m_fallbackTiles = m_terrainTiles;
+    return true;
+  }
+
+  void Autotiler::addTile(CornerTerrains corners, TileId id) {
+    if (id >= (NoTile & ~FlipMask)) {
+      gf::Log::warning("Invalid tile id: %u\n", static_cast<unsigned>(id));
+      return;
+    }
+
+    insertTile(corners, id);
+  }
+
+  void Autotiler::insertTile(CornerTerrains corners, TileId id) {
+    if (!isValid(corners)) {
+      return;
+    }
+
+    if (!isFlat()) {
+      m_exactTiles.emplace(static_cast<uint32_t>(computeIndex(corners)), id);
+      return;
+    }
+
+    std::size_t index = computeIndex(corners);
+
+    if (!m_exact[index]) {
+      m_tiles[index] = id;
+      m_exact[index] = 1;
+    }
+  }
+
+  void Autotiler::addTransformedTiles(CornerTerrains corners, TileId id, TileTransformations transformations) {
+    if (id >= (NoTile & ~FlipMask)) {
+      gf::Log::warning("Invalid tile id: %u\n", static_cast<unsigned>(id));
+      return;
+    }
+
+    // the flips are the bits of the set: 1 is diagonal, 2 is horizontal, 4 is vertical. A rotation needs a
+    // diagonal flip (90 degrees clockwise is diagonal + horizontal), a reflection is a rotation and a flip.
+
+    std::array<uint8_t, 8> flips = { 0 };
+    std::size_t count = 1;
+
+    if (transformations.rotate) {
+      flips[count++] = 1 | 2;
+      flips[count++] = 2 | 4;
+      flips[count++] = 1 | 4;
+    }
+
+    auto addFlip = [&](uint8_t flip) {
+      for (std::size_t i = 0, n = count; i < n; ++i) {
+        uint8_t transformed = flips[i] ^ flip;
+
+        if (std::find(flips.begin(), flips.begin() + count, transformed) == flips.begin() + count) {
+          flips[count++] = transformed;
+        }
+      }
+    };
+
+    if (transformations.hflip) {
+      addFlip(2);
+    }
+
+    if (transformations.vflip) {
+      addFlip(4);
+    }
+
+    for (std::size_t i = 1; i < count; ++i) {
+      // the corners seen in the transformed tile
+      CornerTerrains transformed = corners;
+      TileId flags = 0;
+
+      if (flips[i] & 1) {
+        std::swap(transformed[1], transformed[2]);
+        flags |= FlippedDiagonally;
+      }
+
+      if (flips[i] & 2) {
+        std::swap(transformed[0], transformed[1]);
+        std::swap(transformed[2], transformed[3]);
+        flags |= FlippedHorizontally;
+      }
+
+      if (flips[i] & 4) {
+        std::swap(transformed[0], transformed[2]);
+        std::swap(transformed[1], transformed[3]);
+        flags |= FlippedVertically;
+      }
+
+      insertTile(transformed, id | flags);
+    }
+  }
+
+  void Autotiler::setTerrainTile(int terrain, TileId id) {
+    if (terrain > 0 && terrain <= m_terrainCount) {
+      m_terrainTiles[terrain] = id;
+    }
+  }
+
+  void Autotiler::computeFallbacks() {
+    m_fallbackTiles = m_terrainTiles;
+
+    for (int terrain = 1; terrain <= m_terrainCount; ++terrain) {
+      CornerTerrains corners = { terrain, terrain, terrain, terrain };
+
+      if (m_fallbackTiles[terrain] == NoTile && isExact(corners)) {
+        m_fallbackTiles[terrain] = getTile(corners);
+      }
+    }
+
+    if (!isFlat()) {
+      return;
+    }
+
+    int base = m_terrainCount + 1;
+    CornerTerrains corners;
+
+    for (std::size_t index = 0; index < m_tiles.size(); ++index) {
+      if (m_exact[index]) {
+        continue;
+      }
+
+      std::size_t rest = index;
+
+      for (int k = 3; k >= 0; --k) {
+        corners[k] = static_cast<int>(rest % base);
+        rest /= base;
+      }
+
+      m_tiles[index] = computeFallback(corners);
+    }
+  }
+
+  TileId Autotiler::getTile(CornerTerrains corners) const {
+    if (!isValid(corners)) {
+      return NoTile;
+    }
+
+    if (isFlat()) {
+      return m_tiles[computeIndex(corners)];
+    }
+
+    auto it = m_exactTiles.find(static_cast<uint32_t>(computeIndex(corners)));
+    return it != m_exactTiles.end() ? it->second : computeFallback(corners);
+  }
+
+  bool Autotiler::isExact(CornerTerrains corners) const {
+    if (!isValid(corners)) {
+      return false;
+    }
+
+    if (isFlat()) {
+      return m_exact[computeIndex(corners)] != 0;
+    }
+
+    return m_exactTiles.count(static_cast<uint32_t>(computeIndex(corners))) > 0;
+  }
+
+  std::size_t Autotiler::paint(const gf::Array2D<uint8_t, int>& terrains, gf::Array2D<TileId, int>& tiles, unsigned threads) const {
+    gf::Vector2i size = terrains.getSize() - gf::vec(1, 1);
+
+    if (size.width <= 0 || size.height <= 0) {
+      tiles = gf::Array2D<TileId, int>();
+      return 0;
+    }
+
+    if (tiles.getSize() != size) {
+      tiles = gf::Array2D<TileId, int>(size, NoTile);
+    }
+
+    // the part of the index of each corner, for every possible value of a terrain, so that an invalid terrain
+    // is no terrain and the index of a tile is just four lookups and three additions
+
+    std::size_t base = isFlat() ? static_cast<std::size_t>(m_terrainCount) + 1 : 256;
+    std::size_t limit = static_cast<std::size_t>(m_terrainCount) + 1;
+    std::array<std::array<std::size_t, 256>, 4> parts;
+    std::size_t factor = 1;
+
+    for (int k = 3; k >= 0; --k) {
+      for (std::size_t terrain = 0; terrain < 256; ++terrain) {
+        parts[k][terrain] = terrain < limit ? terrain * factor : 0;
+      }
+
+      factor *= base;
+    }
+
+    int stride = terrains.getSize().width;
+    std::size_t bandCount = (size.height + PaintBandHeight - 1) / PaintBandHeight;
+    std::vector<std::size_t> fallbacks(bandCount, 0);
+
+    parallelFor(bandCount, threads, [&](std::size_t band) {
+      int first = static_cast<int>(band) * PaintBandHeight;
+      int last = std::min(first + PaintBandHeight, size.height);
+      std::size_t count = 0;
+
+      for (int y = first; y < last; ++y) {
+        const uint8_t *top = terrains.getDataPtr() + static_cast<std::size_t>(y) * stride;
+        const uint8_t *bottom = top + stride;
+        TileId *row = &tiles(gf::vec(0, y));
+
+        for (int x = 0; x < size.width; ++x) {
+          std::size_t index = parts[0][top[x]] + parts[1][top[x + 1]] + parts[2][bottom[x]] + parts[3][bottom[x + 1]];
+
+          if (isFlat()) {
+            row[x] = m_tiles[index];
+            count += 1 - m_exact[index];
+            continue;
+          }
+
+          auto it = m_exactTiles.find(static_cast<uint32_t>(index));
+
+          if (it != m_exactTiles.end()) {
+            row[x] = it->second;
+          } else {
+            row[x] = computeFallback({ static_cast<int>(index >> 24), static_cast<int>((index >> 16) & 0xFF), static_cast<int>((index >> 8) & 0xFF), static_cast<int>(index & 0xFF) });
+            ++count;
+          }
+        }
+      }
+
+      fallbacks[band] = count;
+    });
+
+    std::size_t total = 0;
+
+    for (auto count : fallbacks) {
+      total += count;
+    }
+
+    return total;
+  }
+
+  bool Autotiler::loadTsx(const gf::Path& path, Autotiler& autotiler) {
+    std::ifstream file(path.string());
+
+    if (!file) {
+      gf::Log::error("Could not open the tileset: '%s'\n", path.string().c_str());
+      return false;
+    }
+
+    std::ostringstream content;
+    content << file.rdbuf();
+    std::string text = content.str();
+
+    // the first wangset of type corner
+
+    std::size_t offset = 0;
+    std::string element;
+    std::string value;
+
+    for (;;) {
+      if (!findElement(text, "wangset", offset, text.size(), element)) {
+        gf::Log::error("No corner wangset in the tileset: '%s'\n", path.string().c_str());
+        return false;
+      }
+
+      if (findAttribute(element, "type", value) && value == "corner") {
+        break;
+      }
+    }
+
+    std::size_t limit = text.find("</wangset>", offset);
+
+    if (limit == std::string::npos) {
+      limit = text.size();
+    }
+
+    // the terrains are numbered in the order of the wang colors, starting at 1
+
+    std::vector<int> terrainTiles;
+    std::size_t colorOffset = offset;
+
+    while (findElement(text, "wangcolor", colorOffset, limit, element)) {
+      int tile = -1;
+      findIntAttribute(element, "tile", tile);
+      terrainTiles.push_back(tile);
+    }
+
+    // the transformations of the tileset come before the wangsets
+
+    TileTransformations transformations;
+    std::size_t transformationsOffset = 0;
+
+    if (findElement(text, "transformations", transformationsOffset, text.size(), element)) {
+      int allowed = 0;
+      transformations.hflip = findIntAttribute(element, "hflip", allowed) && allowed != 0;
+      transformations.vflip = findIntAttribute(element, "vflip", allowed) && allowed != 0;
+      transformations.rotate = findIntAttribute(element, "rotate", allowed) && allowed != 0;
+    }
+
+    if (!autotiler.reset(static_cast<int>(terrainTiles.size()))) {
+      return false;
+    }
+
+    for (std::size_t i = 0; i < terrainTiles.size(); ++i) {
+      if (terrainTiles[i] >= 0) {
+        autotiler.setTerrainTile(static_cast<int>(i + 1), static_cast<TileId>(terrainTiles[i]));
+      }
+    }
+
+    // wangid: top, top right, right, bottom right, bottom, bottom left, left, top left
+
+    std::size_t tileOffset = offset;
+    std::vector<std::pair<CornerTerrains, TileId>> tiles;
+
+    while (findElement(text, "wangtile", tileOffset, limit, element)) {
+      int id = -1;
+
+      if (!findIntAttribute(element, "tileid", id) || !findAttribute(element, "wangid", value)) {
+        continue;
+      }
+
+      if (id < 0 || static_cast<TileId>(id) >= (NoTile & ~FlipMask)) {
+        gf::Log::warning("Invalid tile id: %i\n", id);
+        continue;
+      }
+
+      std::array<int, 8> wangid = { };
+      std::istringstream stream(value);
+      std::string item;
+      std::size_t count = 0;
+
+      while (count < wangid.size() && std::getline(stream, item, ',')) {
+        wangid[count++] = std::atoi(item.c_str());
+      }
+
+      if (count != wangid.size()) {
+        gf::Log::warning("Invalid wangid for tile %i: '%s'\n", id, value.c_str());
+        continue;
+      }
+
+      tiles.push_back({ { wangid[7], wangid[1], wangid[5], wangid[3] }, static_cast<TileId>(id) });
+      autotiler.addTile(tiles.back().first, tiles.back().second);
+    }
+
+    for (auto& [corners, id] : tiles) {
+      autotiler.addTransformedTiles(corners, id, transformations);
+    }
+
+    autotiler.computeFallbacks();
+    return true;
+  }
+
+  bool Autotiler::isValid(CornerTerrains corners) const {
+    for (auto terrain : corners) {
+      if (terrain < 0 || terrain > m_terrainCount) {
+        return false;
+      }
+    }
+
+    return true;
+  }
+
+  // a flat index, or the four terrains in the bytes of the key of the hash table
+  std::size_t Autotiler::computeIndex(CornerTerrains corners) const {
+    std::size_t base = isFlat() ? static_cast<std::size_t>(m_terrainCount) + 1 : 256;
+    return ((static_cast<std::size_t>(corners[0]) * base + corners[1]) * base + corners[2]) * base + corners[3];
+  }
+
+  TileId Autotiler::computeFallback(CornerTerrains corners) const {
+    int best = 0;
+    int bestCount = 0;
+
+    for (int k = 0; k < 4; ++k) {
+      if (corners[k] == 0) {
+        continue;
+      }
+
+      int count = static_cast<int>(std::count(corners.begin(), corners.end(), corners[k]));
+
+      if (count > bestCount) {
+        best = corners[k];
+        bestCount = count;
+      }
+    }
+
+    return m_fallbackTiles[best];
+  }
+
+}
@@ -0,0 +1,124 @@
+/*
+ * gf-tools
+ * Copyright (C) 2020 Julien Bernard
+ *
+ * This software is provided 'as-is', without any express or implied
+ * warranty.  In no event will the authors be held liable for any damages
+ * arising from the use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ *    claim that you wrote the original software. If you use this software
+ *    in a product, an acknowledgment in the product documentation would be
+ *    appreciated but is not required.
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ *    misrepresented as being the original software.
+ * 3. This notice may not be removed or altered from any source distribution.
+ */
+#ifndef TILESET_AUTOTILER_H
+#define TILESET_AUTOTILER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <array>
+#include <unordered_map>
+#include <vector>
+
+#include <gf/Array2D.h>
+#include <gf/Path.h>
+
+namespace gftools {
+
+  // terrains at the corners of a tile, in the order of Tile::terrain: top left, top right, bottom left, bottom
+  // right. A terrain is the index of the wang color in the tsx, 0 means no terrain
+  using CornerTerrains = std::array<int, 4>;
+
+  // the transformations that Tiled may apply to the tiles of a wang set, see <transformations> in the tsx
+  struct TileTransformations {
+    bool hflip = false;
+    bool vflip = false;
+    bool rotate = false;
+  };
+
+  // the id of a tile in the tsx, with the flips of Tiled in its high bits, see Autotiler
+  using TileId = uint32_t;
+
+  // resolve the corner terrains of a tile to the id of a tile, with a flat lookup table indexed by the four
+  // terrains, or a hash table of the exact combinations if there are too many terrains for a flat table. This is
+  // meant to be used at runtime, with the tsx exported by gf_tileset.
+  class Autotiler {
+  public:
+    static constexpr int MaxTerrainCount = 255; // the terrains of paint are bytes
+    static constexpr int MaxFlatTerrainCount = 32; // the flat table has (count + 1)^4 entries
+
+    // the flips of a transformed tile are in the high bits of its id, as in the global ids of a Tiled map: the
+    // diagonal flip is applied first, then the horizontal flip, then the vertical flip. The ids of the tiles must be
+    // below NoTile & ~FlipMask, so that no flipped id is NoTile.
+    static constexpr TileId FlippedHorizontally = UINT32_C(0x80000000);
+    static constexpr TileId FlippedVertically = UINT32_C(0x40000000);
+    static constexpr TileId FlippedDiagonally = UINT32_C(0x20000000);
+    static constexpr TileId FlipMask = FlippedHorizontally | FlippedVertically | FlippedDiagonally;
+    static constexpr TileId NoTile = UINT32_C(0xFFFFFFFF);
+
+    // no terrain, see reset
+    Autotiler();
+
+    // remove all the tiles. False if the count is not in [0, MaxTerrainCount], then the autotiler has no terrain
+    bool reset(int terrainCount);
+
+    int getTerrainCount() const {
+      return m_terrainCount;
+    }
+
+    // the first tile added for a combination is kept, an id that is not below NoTile & ~FlipMask is ignored with a warning
+    void addTile(CornerTerrains corners, TileId id);
+    // the rotations and reflections of the tile that are allowed, with the flips in their ids. They must be added
+    // after the untransformed tiles so that a combination that has its own tile keeps it.
+    void addTransformedTiles(CornerTerrains corners, TileId id, TileTransformations transformations);
+    // the tile of a plain terrain, by default the tile with this terrain at the four corners
+    void setTerrainTile(int terrain, TileId id);
+
+    // a missing combination gets the tile of the terrain that is on most of its corners (the first corner
+    // wins in case of a tie), or NoTile. Must be called once all the tiles are added.
+    void computeFallbacks();
+
+    TileId getTile(CornerTerrains corners) const;
+    bool isExact(CornerTerrains corners) const;
+
+    // the tile at (x, y) has the corners (x, y), (x + 1, y), (x, y + 1) and (x + 1, y + 1) so terrains has one
+    // more column and one more row than tiles. Terrains outside [0, count] are treated as no terrain.
+    // Returns the number of tiles that come from a fallback.
+    std::size_t paint(const gf::Array2D<uint8_t, int>& terrains, gf::Array2D<TileId, int>& tiles, unsigned threads = 0) const;
+
+    // the first corner wangset of the tsx, with the transformed tiles if the tsx allows them. False if the file
+    // can not be read or if it has too many terrains.
+    static bool loadTsx(const gf::Path& path, Autotiler& autotiler);
+
+  private:
+    bool isFlat() const {
+      return m_terrainCount <= MaxFlatTerrainCount;
+    }
+
+    bool isValid(CornerTerrains corners) const;
+    // the id may have flips
+    void insertTile(CornerTerrains corners, TileId id);
+    std::size_t computeIndex(CornerTerrains corners) const;
+    TileId computeFallback(CornerTerrains corners) const;
+
+  private:
+    int m_terrainCount = 0;
+    // the flat table, the fallbacks included
+    std::vector<TileId> m_tiles;
+    std::vector<uint8_t> m_exact;
+    // the exact tiles when the table is not flat, the fallbacks are computed on demand
+    std::unordered_map<uint32_t, TileId> m_exactTiles;
+    std::vector<TileId> m_terrainTiles;
+    std::vector<TileId> m_fallbackTiles; // the tile of each terrain after computeFallbacks
+  };
+
+}
+
+#endif // TILESET_AUTOTILER_H
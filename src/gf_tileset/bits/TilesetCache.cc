@@ -0,0 +1,585 @@
+/*
+ * gf-tools
+ * Copyright (C) 2020 Julien Bernard
+ *
+ * This software is provided 'as-is', without any express or implied
+ * warranty.  In no event will the authors be held liable for any damages
+ * arising from the use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ *    claim that you wrote the original software. If you use this software
+ *    in a product, an acknowledgment in the product documentation would be
+ *    appreciated but is not required.
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ *    misrepresented as being the original software.
+ * 3. This notice may not be removed or altered from any source distribution.
+ */
+#include "TilesetCache.h"
+
+#include <cassert>
+#include <algorithm>
+#include <cinttypes>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <set>
+#include <string>
+#include <system_error>
+#include <type_traits>
+
+#include <gf/Log.h>
+
+#include "TilesetProcess.h"
+
+namespace gftools {
+
+  namespace {
+
+    // must be incremented each time the generation, the colorization or the format of the entries change
+    constexpr uint32_t CacheVersion = 6;
+    constexpr char CacheMagic[4] = { 'g', 'f', 't', 'c' };
+    constexpr char GeometryMagic[4] = { 'g', 'f', 't', 'g' };
+    constexpr const char *CacheExtension = ".tileset";
+    constexpr const char *GeometryExtension = ".geometry";
+
+    /*
+     * key
+     */
+
+    // see http://www.isthe.com/chongo/tech/comp/fnv/
+    class Hasher {
+    public:
+      template<typename T>
+      void add(T value) {
+        static_assert(std::is_arithmetic<T>::value || std::is_enum<T>::value, "Only scalars can be hashed");
+        unsigned char bytes[sizeof(T)];
+        std::memcpy(bytes, &value, sizeof(T));
+
+        for (auto byte : bytes) {
+          m_hash ^= byte;
+          m_hash *= UINT64_C(0x100000001b3);
+        }
+      }
+
+      uint64_t get() const {
+        return m_hash;
+      }
+
+    private:
+      uint64_t m_hash = UINT64_C(0xcbf29ce484222325);
+    };
+
+    void hashAtom(Hasher& hasher, const Atom& atom) {
+      hasher.add(atom.id.hash);
+      hasher.add(atom.color.r);
+      hasher.add(atom.color.g);
+      hasher.add(atom.color.b);
+      hasher.add(atom.color.a);
+      hasher.add(atom.pigment.style);
+
+      switch (atom.pigment.style) {
+        case PigmentStyle::Plain:
+          break;
+        case PigmentStyle::Randomize:
+          hasher.add(atom.pigment.randomize.ratio);
+          hasher.add(atom.pigment.randomize.deviation);
+          hasher.add(atom.pigment.randomize.size);
+          break;
+        case PigmentStyle::Striped:
+          hasher.add(atom.pigment.striped.width);
+          hasher.add(atom.pigment.striped.stride);
+          break;
+        case PigmentStyle::Paved:
+          hasher.add(atom.pigment.paved.width);
+          hasher.add(atom.pigment.paved.length);
+          hasher.add(atom.pigment.paved.modulation);
+          break;
+      }
+    }
+
+    void hashEdge(Hasher& hasher, const Edge& edge) {
+      hasher.add(edge.offset);
+      hasher.add(edge.displacement.iterations);
+      hasher.add(edge.displacement.initial);
+      hasher.add(edge.displacement.reduction);
+      hasher.add(edge.limit);
+    }
+
+    void hashBorder(Hasher& hasher, const Border& border) {
+      hasher.add(border.id.hash);
+      hasher.add(border.effect);
+
+      switch (border.effect) {
+        case BorderEffect::None:
+          break;
+        case BorderEffect::Fade:
+          hasher.add(border.fade.distance);
+          break;
+        case BorderEffect::Outline:
+          hasher.add(border.outline.distance);
+          hasher.add(border.outline.factor);
+          break;
+        case BorderEffect::Sharpen:
+          hasher.add(border.sharpen.distance);
+          hasher.add(border.sharpen.max);
+          break;
+        case BorderEffect::Lighten:
+          hasher.add(border.lighten.distance);
+          hasher.add(border.lighten.max);
+          break;
+        case BorderEffect::Blur:
+          break;
+        case BorderEffect::Blend:
+          hasher.add(border.blend.distance);
+          break;
+      }
+    }
+
+    void hashWang2(Hasher& hasher, const Wang2& wang) {
+      hashBorder(hasher, wang.borders[0]);
+      hashBorder(hasher, wang.borders[1]);
+      hashEdge(hasher, wang.edge);
+    }
+
+    // nothing is added without salts, so that the keys of the tilesets that were never rolled again do not change
+    void hashSalts(Hasher& hasher, const TilesetData& db, std::size_t index) {
+      for (auto& tile : getTilesetSalts(db, index)) {
+        hasher.add(tile.position.x);
+        hasher.add(tile.position.y);
+        hasher.add(tile.salt);
+      }
+    }
+
+    void hashGeometrySettings(Hasher& hasher, const TilesetData& db) {
+      hasher.add(CacheVersion);
+      hasher.add(db.settings.tile.size);
+      hasher.add(db.settings.seed);
+    }
+
+    void hashWang2Geometry(Hasher& hasher, const Wang2& wang) {
+      hasher.add(wang.borders[0].id.hash);
+      hasher.add(wang.borders[1].id.hash);
+      hashEdge(hasher, wang.edge);
+    }
+
+    void hashWang3Geometry(Hasher& hasher, const TilesetData& db, const Wang3& wang) {
+      for (int i = 0; i < 3; ++i) {
+        hasher.add(wang.ids[i].hash);
+        hashEdge(hasher, db.getEdge(wang.ids[i].hash, wang.ids[(i + 1) % 3].hash));
+      }
+    }
+
+    /*
+     * entries
+     */
+
+    template<typename T>
+    void write(std::ostream& stream, T value) {
+      stream.write(reinterpret_cast<const char *>(&value), sizeof(T));
+    }
+
+    template<typename T>
+    bool read(std::istream& stream, T& value) {
+      return static_cast<bool>(stream.read(reinterpret_cast<char *>(&value), sizeof(T)));
+    }
+
+    void writeTile(std::ostream& stream, const Tile& tile) {
+      write<int32_t>(stream, tile.origin.count);
+
+      for (auto id : tile.origin.ids) {
+        write<uint64_t>(stream, id);
+      }
+
+      for (auto id : tile.terrain) {
+        write<uint64_t>(stream, id);
+      }
+
+      write<int32_t>(stream, tile.fences.count);
+
+      for (auto& segment : tile.fences.segments) {
+        write<int32_t>(stream, segment.p0.x);
+        write<int32_t>(stream, segment.p0.y);
+        write<int32_t>(stream, segment.p1.x);
+        write<int32_t>(stream, segment.p1.y);
+      }
+    }
+
+    // the counts are checked against the arrays of the tile
+    bool readTile(std::istream& stream, Tile& tile) {
+      int32_t count = 0;
+      bool ok = read(stream, count) && count >= 0 && count <= static_cast<int32_t>(std::extent<decltype(Origin::ids)>::value);
+      tile.origin.count = count;
+
+      for (auto& id : tile.origin.ids) {
+        ok = ok && read(stream, id);
+      }
+
+      for (auto& id : tile.terrain) {
+        ok = ok && read(stream, id);
+      }
+
+      ok = ok && read(stream, count) && count >= 0 && count <= static_cast<int32_t>(std::extent<decltype(Fences::segments)>::value);
+      tile.fences.count = count;
+
+      for (auto& segment : tile.fences.segments) {
+        int32_t coords[4];
+
+        for (auto& coord : coords) {
+          ok = ok && read(stream, coord);
+        }
+
+        segment.p0 = gf::vec(coords[0], coords[1]);
+        segment.p1 = gf::vec(coords[2], coords[3]);
+      }
+
+      return ok;
+    }
+
+    bool isValidSize(gf::Vector2i size, const TilesetCache::Shape& shape) {
+      if (shape.canonical) {
+        return size.height == 1 && size.width > 0 && size.width <= shape.size.width * shape.size.height;
+      }
+
+      return size == shape.size;
+    }
+
+    void writeHeader(std::ostream& stream, const char *magic, uint64_t key) {
+      stream.write(magic, 4);
+      write<uint32_t>(stream, CacheVersion);
+      write<uint64_t>(stream, key);
+    }
+
+    bool readHeader(std::istream& stream, const char *magic, uint64_t key) {
+      char storedMagic[4];
+      uint32_t version = 0;
+      uint64_t storedKey = 0;
+      return stream.read(storedMagic, sizeof storedMagic) && std::memcmp(storedMagic, magic, sizeof storedMagic) == 0 && read(stream, version) && version == CacheVersion && read(stream, storedKey) && storedKey == key;
+    }
+
+    // the entry is written in a temporary file so that an interrupted export never leaves a partial entry
+    template<typename Func>
+    void writeEntry(const gf::Path& path, Func func) {
+      gf::Path temporary = path;
+      temporary += ".tmp";
+
+      {
+        std::ofstream file(temporary, std::ios::binary | std::ios::trunc);
+
+        if (!file) {
+          gf::Log::warning("Could not write the cache entry: '%s'\n", temporary.string().c_str());
+          return;
+        }
+
+        func(file);
+
+        if (!file) {
+          gf::Log::warning("Could not write the cache entry: '%s'\n", temporary.string().c_str());
+          return;
+        }
+      }
+
+      std::error_code error;
+      std::filesystem::rename(temporary, path, error);
+
+      if (error) {
+        gf::Log::warning("Could not write the cache entry: '%s'\n", path.string().c_str());
+      }
+    }
+
+  }
+
+  TilesetCache::TilesetCache(gf::Path directory, uint32_t seed)
+  : m_directory(std::move(directory))
+  , m_seed(seed)
+  {
+    std::error_code error;
+    std::filesystem::create_directories(m_directory, error);
+
+    if (error) {
+      gf::Log::warning("Could not create the cache directory: '%s'\n", m_directory.string().c_str());
+    }
+  }
+
+  uint64_t TilesetCache::computeKey(const TilesetData& db, std::size_t index, bool canonical) {
+    Hasher hasher;
+    hasher.add(CacheVersion);
+    hasher.add(db.settings.tile.size);
+    hasher.add(db.settings.tile.spacing);
+    hasher.add(db.settings.metric);
+    hasher.add(db.settings.seed);
+    hasher.add(static_cast<uint64_t>(index));
+    hashSalts(hasher, db, index);
+
+    if (index < db.atoms.size()) {
+      hashAtom(hasher, db.atoms[index]);
+      return hasher.get();
+    }
+
+    index -= db.atoms.size();
+
+    if (index < db.wang2.size()) {
+      const Wang2& wang = db.wang2[index];
+      hashWang2(hasher, wang);
+      hashAtom(hasher, db.getAtom(wang.borders[0].id.hash));
+      hashAtom(hasher, db.getAtom(wang.borders[1].id.hash));
+
+      if (canonical) {
+        hasher.add(canonical); // the full tilesets keep their keys
+      }
+
+      return hasher.get();
+    }
+
+    index -= db.wang2.size();
+    assert(index < db.wang3.size());
+    const Wang3& wang = db.wang3[index];
+
+    for (auto& id : wang.ids) {
+      hashAtom(hasher, db.getAtom(id.hash));
+    }
+
+    for (int i = 0; i < 3; ++i) {
+      auto side = db.getWang2(wang.ids[i].hash, wang.ids[(i + 1) % 3].hash);
+
+      if (side != nullptr) {
+        hashWang2(hasher, *side);
+      } else {
+        hasher.add(Void); // a missing wang2
+      }
+    }
+
+    return hasher.get();
+  }
+
+  uint64_t TilesetCache::computeGeometryKey(const TilesetData& db, std::size_t index, bool canonical) {
+    Hasher hasher;
+    hashGeometrySettings(hasher, db);
+    hasher.add(static_cast<uint64_t>(index)); // the random of the tiles comes from the index
+    hashSalts(hasher, db, index);
+
+    if (index < db.atoms.size()) {
+      hasher.add(db.atoms[index].id.hash);
+      return hasher.get();
+    }
+
+    index -= db.atoms.size();
+
+    if (index < db.wang2.size()) {
+      hashWang2Geometry(hasher, db.wang2[index]);
+
+      if (canonical) {
+        hasher.add(canonical);
+      }
+
+      return hasher.get();
+    }
+
+    index -= db.wang2.size();
+    assert(index < db.wang3.size());
+    hashWang3Geometry(hasher, db, db.wang3[index]);
+    return hasher.get();
+  }
+
+  uint64_t TilesetCache::computeGeometryKey(const TilesetData& db, const Wang2& wang) {
+    Hasher hasher;
+    hashGeometrySettings(hasher, db);
+    hashWang2Geometry(hasher, wang);
+    return hasher.get();
+  }
+
+  uint64_t TilesetCache::computeGeometryKey(const TilesetData& db, const Wang3& wang) {
+    Hasher hasher;
+    hashGeometrySettings(hasher, db);
+    hashWang3Geometry(hasher, db, wang);
+    return hasher.get();
+  }
+
+  TilesetCache::Shape TilesetCache::computeShape(const TilesetData& db, std::size_t index, bool canonical) {
+    int size = getTilesetSize(db, index);
+    return { gf::vec(size, size), canonical, db.settings.tile.size, db.settings.tile.getExtendedSize() };
+  }
+
+  bool TilesetCache::load(uint64_t key, const Shape& shape, Tileset& tileset, TilesetPixels& pixels) const {
+    std::ifstream file(getEntryPath(key, CacheExtension), std::ios::binary);
+
+    if (!file || !readHeader(file, CacheMagic, key)) {
+      return false;
+    }
+
+    int32_t width = 0;
+    int32_t height = 0;
+    uint64_t pixelCount = 0;
+
+    if (!read(file, width) || !read(file, height) || !isValidSize(gf::vec(width, height), shape)) {
+      return false;
+    }
+
+    Tileset entry(gf::vec(width, height));
+
+    for (auto position : entry.tiles.getPositionRange()) {
+      if (!readTile(file, entry(position))) {
+        return false;
+      }
+    }
+
+    uint64_t expectedPixelCount = static_cast<uint64_t>(width) * height * shape.extendedTileSize * shape.extendedTileSize * 4;
+
+    if (!read(file, pixelCount) || pixelCount != expectedPixelCount) {
+      return false;
+    }
+
+    TilesetPixels data(pixelCount);
+
+    if (!file.read(reinterpret_cast<char *>(data.data()), static_cast<std::streamsize>(data.size()))) {
+      return false;
+    }
+
+    entry.position = tileset.position;
+    tileset = std::move(entry);
+    pixels = std::move(data);
+    return true;
+  }
+
+  void TilesetCache::save(uint64_t key, const Tileset& tileset, const TilesetPixels& pixels) const {
+    writeEntry(getEntryPath(key, CacheExtension), [&](std::ostream& file) {
+      writeHeader(file, CacheMagic, key);
+
+      auto size = tileset.tiles.getSize();
+      write<int32_t>(file, size.width);
+      write<int32_t>(file, size.height);
+
+      for (auto position : tileset.tiles.getPositionRange()) {
+        writeTile(file, tileset(position));
+      }
+
+      write<uint64_t>(file, pixels.size());
+      file.write(reinterpret_cast<const char *>(pixels.data()), static_cast<std::streamsize>(pixels.size()));
+    });
+  }
+
+  bool TilesetCache::loadGeometry(uint64_t key, const Shape& shape, Tileset& tileset) const {
+    std::ifstream file(getEntryPath(key, GeometryExtension), std::ios::binary);
+
+    if (!file || !readHeader(file, GeometryMagic, key)) {
+      return false;
+    }
+
+    int32_t width = 0;
+    int32_t height = 0;
+    int32_t tileSize = 0;
+
+    if (!read(file, width) || !read(file, height) || !read(file, tileSize) || !isValidSize(gf::vec(width, height), shape) || tileSize != shape.tileSize) {
+      return false;
+    }
+
+    // the same arena as a generated tileset
+    auto arena = std::make_shared<TileArena>(static_cast<std::size_t>(width) * height * tileSize * tileSize);
+    TileArena::Scope scope(*arena);
+
+    Tileset entry(gf::vec(width, height));
+    std::vector<uint8_t> labels(static_cast<std::size_t>(tileSize) * tileSize);
+
+    for (auto position : entry.tiles.getPositionRange()) {
+      Tile& tile = entry(position);
+
+      if (!readTile(file, tile)) {
+        return false;
+      }
+
+      tile.pixels = Pixels(gf::vec(tileSize, tileSize), gf::InvalidId);
+
+      for (auto& id : tile.pixels.palette) {
+        if (!read(file, id)) {
+          return false;
+        }
+      }
+
+      if (!file.read(reinterpret_cast<char *>(labels.data()), static_cast<std::streamsize>(labels.size()))) {
+        return false;
+      }
+
+      if (std::any_of(labels.begin(), labels.end(), [](uint8_t label) { return label >= Pixels::PaletteSize; })) {
+        return false;
+      }
+
+      tile.pixels.data.setLabels(labels.data());
+    }
+
+    entry.arena = std::move(arena);
+    entry.position = tileset.position;
+    tileset = std::move(entry);
+    return true;
+  }
+
+  void TilesetCache::saveGeometry(uint64_t key, const Tileset& tileset) const {
+    writeEntry(getEntryPath(key, GeometryExtension), [&](std::ostream& file) {
+      writeHeader(file, GeometryMagic, key);
+
+      auto size = tileset.tiles.getSize();
+      int32_t tileSize = size.width > 0 && size.height > 0 ? tileset(gf::vec(0, 0)).pixels.data.getSize().width : 0;
+      write<int32_t>(file, size.width);
+      write<int32_t>(file, size.height);
+      write<int32_t>(file, tileSize);
+
+      for (auto position : tileset.tiles.getPositionRange()) {
+        const Tile& tile = tileset(position);
+        assert(tile.pixels.data.getSize() == gf::vec(tileSize, tileSize));
+        writeTile(file, tile);
+
+        for (auto id : tile.pixels.palette) {
+          write<uint64_t>(file, id);
+        }
+
+        file.write(reinterpret_cast<const char *>(tile.pixels.data.getDataPtr()), static_cast<std::streamsize>(tileSize) * tileSize);
+      }
+    });
+  }
+
+  void TilesetCache::prune(const std::vector<uint64_t>& keys) const {
+    std::set<gf::Path> valid;
+
+    for (auto key : keys) {
+      valid.insert(getEntryPath(key, CacheExtension));
+      valid.insert(getEntryPath(key, GeometryExtension));
+    }
+
+    std::error_code error;
+    std::vector<gf::Path> obsolete;
+
+    char prefix[16];
+    std::snprintf(prefix, sizeof prefix, "%08" PRIx32 "-", m_seed);
+
+    for (auto& entry : std::filesystem::directory_iterator(m_directory, error)) {
+      const gf::Path& path = entry.path();
+
+      if ((path.extension() != CacheExtension && path.extension() != GeometryExtension) || valid.count(path) > 0) {
+        continue;
+      }
+
+      // the entries without a prefix come from an older version of the cache
+      std::string name = path.filename().string();
+      bool hasPrefix = name.size() > 9 && name[8] == '-';
+
+      if (!hasPrefix || name.compare(0, 9, prefix) == 0) {
+        obsolete.push_back(path);
+      }
+    }
+
+    for (auto& path : obsolete) {
+      std::filesystem::remove(path, error);
+    }
+  }
+
+  gf::Path TilesetCache::getEntryPath(uint64_t key, const char *extension) const {
+    char name[48];
+    std::snprintf(name, sizeof name, "%08" PRIx32 "-%016" PRIx64 "%s", m_seed, key, extension);
+    return m_directory / name;
+  }
+
+}
@@ -0,0 +1,86 @@
+/*
+ * gf-tools
+ * Copyright (C) 2020 Julien Bernard
+ *
+ * This software is provided 'as-is', without any express or implied
+ * warranty.  In no event will the authors be held liable for any damages
+ * arising from the use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ *    claim that you wrote the original software. If you use this software
+ *    in a product, an acknowledgment in the product documentation would be
+ *    appreciated but is not required.
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ *    misrepresented as being the original software.
+ * 3. This notice may not be removed or altered from any source distribution.
+ */
+#ifndef TILESET_CACHE_H
+#define TILESET_CACHE_H
+
+#include <cstdint>
+#include <vector>
+
+#include <gf/Path.h>
+
+#include "TilesetData.h"
+#include "TilesetGeneration.h"
+
+namespace gftools {
+
+  // pixels of a colorized tileset, in RGBA
+  using TilesetPixels = std::vector<uint8_t>;
+
+  // cache of the generated and colorized tilesets, each entry is a file named after the key of the tileset
+  class TilesetCache {
+  public:
+    // the entries are prefixed by the seed, so that an export with another seed (e.g. --seed) does not prune the
+    // entries of the seed of the project
+    TilesetCache(gf::Path directory, uint32_t seed);
+
+    // the key depends on everything that has an influence on the tileset, canonical is set when the tileset only
+    // has the canonical tiles (see generateTileset)
+    static uint64_t computeKey(const TilesetData& db, std::size_t index, bool canonical = false);
+
+    // the key of the geometry of the tiles (the biomes of the pixels, the terrains and the fences), it only
+    // depends on the tile size, the seed, the biomes and the edges, not on the colors
+    static uint64_t computeGeometryKey(const TilesetData& db, std::size_t index, bool canonical = false);
+    // for the previews, that are not in the database: the key only depends on the content
+    static uint64_t computeGeometryKey(const TilesetData& db, const Wang2& wang);
+    static uint64_t computeGeometryKey(const TilesetData& db, const Wang3& wang);
+
+    // what an entry of a tileset must look like, anything else comes from a corrupted entry and is a cache miss
+    struct Shape {
+      gf::Vector2i size; // a canonical tileset has its tiles on one line, at most size.width * size.height tiles
+      bool canonical;
+      int tileSize;
+      int extendedTileSize;
+    };
+
+    static Shape computeShape(const TilesetData& db, std::size_t index, bool canonical = false);
+
+    bool load(uint64_t key, const Shape& shape, Tileset& tileset, TilesetPixels& pixels) const;
+    void save(uint64_t key, const Tileset& tileset, const TilesetPixels& pixels) const;
+
+    // the pixels of the tiles are allocated in an arena
+    bool loadGeometry(uint64_t key, const Shape& shape, Tileset& tileset) const;
+    void saveGeometry(uint64_t key, const Tileset& tileset) const;
+
+    // remove the entries (tilesets and geometries) of the seed that are not in keys, the entries of the other seeds
+    // are kept
+    void prune(const std::vector<uint64_t>& keys) const;
+
+  private:
+    gf::Path getEntryPath(uint64_t key, const char *extension) const;
+
+  private:
+    gf::Path m_directory;
+    uint32_t m_seed;
+  };
+
+}
+
+#endif // TILESET_CACHE_H
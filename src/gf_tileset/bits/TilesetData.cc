@@ -1,8 +1,14 @@
 #include "TilesetData.h"
 
+#include <cassert>
 #include <cinttypes>
+#include <algorithm>
+#include <array>
 #include <cstdint>
 #include <fstream>
+#include <functional>
+#include <iterator>
+#include <limits>
 
 #include <nlohmann/json.hpp>
 
@@ -32,93 +38,67 @@ namespace nlohmann {
 
 namespace gftools {
 
-  ImageFeatures Settings::getImageFeatures() const {
-    auto size = tile.getExtendedSize();
-    int step = size * 12;
-
-    for (int width = step; width <= 8192; width += step) {
-      int height = 0;
-
-      int atomsPerLine = width / (AtomsTilesetSize * size);
-
-      if (atomsPerLine == 0) {
-        continue;
-      }
-
-      int atomsLineCount = maxAtomCount / atomsPerLine + ((maxAtomCount % atomsPerLine == 0) ? 0 : 1);
-      height += atomsLineCount * (AtomsTilesetSize * size);
-
-      if (height > width) {
-        continue;
-      }
-
-      int wang2PerLine = width / (Wang2TilesetSize * size);
-
-      if (wang2PerLine == 0) {
-        continue;
-      }
-
-      int wang2LineCount = maxWang2Count / wang2PerLine + ((maxWang2Count % wang2PerLine == 0) ? 0 : 1);
-      height += wang2LineCount * (Wang2TilesetSize * size);
+  AtomTriple::AtomTriple(gf::Id id0, gf::Id id1, gf::Id id2)
+  : ids{ id0, id1, id2 }
+  {
+    std::sort(std::begin(ids), std::end(ids));
+  }
 
-      if (height > width) {
-        continue;
-      }
+  void TilesetData::rebuildIndex() {
+    m_atomIndex.clear();
 
-      int wang3PerLine = width / (Wang3TilesetSize * size);
+    for (std::size_t i = 0; i < atoms.size(); ++i) {
+      m_atomIndex.emplace(atoms[i].id.hash, i);
+    }
 
-      if (wang3PerLine == 0) {
-        continue;
-      }
+    m_wang2Index.clear();
+    m_neighbors.clear();
 
-      int wang3LineCount = maxWang3Count / wang3PerLine + ((maxWang3Count % wang3PerLine == 0) ? 0 : 1);
-      height += wang3LineCount * (Wang3TilesetSize * size);
+    for (std::size_t i = 0; i < wang2.size(); ++i) {
+      gf::Id id0 = wang2[i].borders[0].id.hash;
+      gf::Id id1 = wang2[i].borders[1].id.hash;
 
-      if (height > width) {
+      if (!m_wang2Index.emplace(AtomPair(id0, id1), i).second || id0 == id1) {
         continue;
       }
 
-      gf::Log::debug("atoms: %i x %i (%i)\n", atomsPerLine, atomsLineCount, atomsPerLine * atomsLineCount);
-      gf::Log::debug("wang2: %i x %i (%i)\n", wang2PerLine, wang2LineCount, wang2PerLine * wang2LineCount);
-      gf::Log::debug("wang3: %i x %i (%i)\n", wang3PerLine, wang3LineCount, wang3PerLine * wang3LineCount);
+      m_neighbors[id0].push_back(id1);
+      m_neighbors[id1].push_back(id0);
+    }
+  }
 
-      ImageFeatures features;
-      features.size = gf::vec(width, height);
-      features.atomsPerLine = atomsPerLine;
-      features.atomsLineCount = atomsLineCount;
-      features.wang2PerLine = wang2PerLine;
-      features.wang2LineCount = wang2LineCount;
-      features.wang3PerLine = wang3PerLine;
-      features.wang3LineCount = wang3LineCount;
+  namespace {
 
-      return features;
+    Atom createVoidAtom() {
+      Atom voidAtom;
+      voidAtom.id.hash = Void;
+      voidAtom.id.name = "-";
+      voidAtom.color = gf::Color::Transparent;
+      voidAtom.pigment.style = PigmentStyle::Plain;
+      return voidAtom;
     }
 
-    return ImageFeatures{};
-  }
+    bool isSamePair(const Wang2& wang, gf::Id id0, gf::Id id1) {
+      return AtomPair(wang.borders[0].id.hash, wang.borders[1].id.hash) == AtomPair(id0, id1);
+    }
 
-  gf::Vector2i Settings::getImageSize() const {
-    return getImageFeatures().size;
   }
 
-  Atom TilesetData::getAtom(gf::Id hash, Search search) const {
+  const Atom& TilesetData::getAtom(gf::Id hash, Search search) const {
     if (search == Search::IncludeTemporary) {
       if (temporary.atom.id.hash == hash) {
         return temporary.atom;
       }
     }
 
-    for (auto& atom : atoms) {
-      if (atom.id.hash == hash) {
-        return atom;
-      }
+    auto it = m_atomIndex.find(hash);
+
+    if (it != m_atomIndex.end()) {
+      assert(atoms[it->second].id.hash == hash);
+      return atoms[it->second];
     }
 
-    Atom voidAtom;
-    voidAtom.id.hash = Void;
-    voidAtom.id.name = "-";
-    voidAtom.color = gf::Color::Transparent;
-    voidAtom.pigment.style = PigmentStyle::Plain;
+    static const Atom voidAtom = createVoidAtom();
 
     if (hash != Void) {
       gf::Log::warning("Unknown atom hash: %" PRIX64 "\n", hash);
@@ -127,68 +107,36 @@ namespace gftools {
     return voidAtom;
   }
 
-  Wang2 TilesetData::getWang2(gf::Id id0, gf::Id id1, Search search) const {
+  const Wang2 *TilesetData::getWang2(gf::Id id0, gf::Id id1, Search search) const {
     if (search == Search::IncludeTemporary) {
-      if (temporary.wang2.borders[0].id.hash == id0 && temporary.wang2.borders[1].id.hash == id1) {
-        return temporary.wang2;
-      }
-
-      if (temporary.wang2.borders[0].id.hash == id1 && temporary.wang2.borders[1].id.hash == id0) {
-        return temporary.wang2;
+      if (isSamePair(temporary.wang2, id0, id1)) {
+        return &temporary.wang2;
       }
     }
 
-    for (auto& wang : wang2) {
-      if (wang.borders[0].id.hash == id0 && wang.borders[1].id.hash == id1) {
-        return wang;
-      }
+    auto it = m_wang2Index.find(AtomPair(id0, id1));
 
-      if (wang.borders[0].id.hash == id1 && wang.borders[1].id.hash == id0) {
-        return wang;
-      }
+    if (it != m_wang2Index.end()) {
+      assert(isSamePair(wang2[it->second], id0, id1));
+      return &wang2[it->second];
     }
 
-    Atom a0 = getAtom(id0);
-    Atom a1 = getAtom(id1);
-
-    gf::Log::warning("No wang2 for this pair of atoms: (%s, %s)\n", a0.id.name.c_str(), a1.id.name.c_str());
-
-    Wang2 wang;
-    wang.borders[0].id = a0.id;
-    wang.borders[0].effect = BorderEffect::None;
-    wang.borders[1].id = a1.id;
-    wang.borders[1].effect = BorderEffect::None;
-
-    if (id0 == Void) {
-      std::swap(wang.borders[0].id, wang.borders[1].id);
-    }
-
-    return wang;
+    return nullptr;
   }
 
   Edge TilesetData::getEdge(gf::Id id0, gf::Id id1, Search search) const {
-    if (search == Search::IncludeTemporary) {
-      if (temporary.wang2.borders[0].id.hash == id0 && temporary.wang2.borders[1].id.hash == id1) {
-        return temporary.wang2.edge;
-      }
+    auto wang = getWang2(id0, id1, search);
 
-      if (temporary.wang2.borders[0].id.hash == id1 && temporary.wang2.borders[1].id.hash == id0) {
-        return temporary.wang2.edge.invert();
-      }
+    if (wang == nullptr) {
+      Edge edge;
+      return edge;
     }
 
-    for (auto& wang : wang2) {
-      if (wang.borders[0].id.hash == id0 && wang.borders[1].id.hash == id1) {
-        return wang.edge;
-      }
-
-      if (wang.borders[0].id.hash == id1 && wang.borders[1].id.hash == id0) {
-        return wang.edge.invert();
-      }
+    if (wang->borders[0].id.hash == id0) {
+      return wang->edge;
     }
 
-    Edge edge;
-    return edge;
+    return wang->edge.invert();
   }
 
   void TilesetData::updateAtom(Atom oldAtom, Atom newAtom) {
@@ -213,6 +161,9 @@ namespace gftools {
         }
       }
     }
+
+    rebuildIndex();
+    rebuildWang3Index();
   }
 
   void TilesetData::deleteAtom(gf::Id id) {
@@ -227,48 +178,225 @@ namespace gftools {
     wang3.erase(std::remove_if(wang3.begin(), wang3.end(), [id](auto& wang) {
       return wang.ids[0].hash == id || wang.ids[1].hash == id || wang.ids[2].hash == id;
     }), wang3.end());
+
+    rebuildIndex();
+    rebuildWang3Index();
+  }
+
+  namespace {
+
+    const AtomId& findAtomId(const Wang2& wang, gf::Id hash) {
+      return wang.borders[0].id.hash == hash ? wang.borders[0].id : wang.borders[1].id;
+    }
+
+    Wang3 createWang3(AtomId id0, AtomId id1, AtomId id2) {
+      std::array<AtomId, 3> ids = { std::move(id0), std::move(id1), std::move(id2) };
+      std::sort(ids.begin(), ids.end(), [](const AtomId & lhs, const AtomId & rhs) { return lhs.hash < rhs.hash; });
+
+      Wang3 wang;
+      wang.ids[0] = ids[0];
+      wang.ids[1] = ids[1];
+      wang.ids[2] = ids[2];
+
+      if (wang.ids[0].hash == Void) {
+        std::swap(wang.ids[0], wang.ids[2]);
+      }
+
+      if (wang.ids[1].hash == Void) {
+        std::swap(wang.ids[1], wang.ids[2]);
+      }
+
+      return wang;
+    }
+
   }
 
   void TilesetData::generateAllWang3() {
     wang3.clear();
-    std::size_t count = wang2.size();
 
-    for (std::size_t i = 0; i < count; ++i) {
-      auto & w0 = wang2[i];
+    // a wang3 is a triangle in the graph of atoms, they are listed by orienting every edge from the
+    // atom with the lower degree to the atom with the higher degree, so that each triangle is found
+    // exactly once and the cost depends on the number of edges, not on the cube of the number of wang2
+    // see Chiba and Nishizeki, Arboricity and Subgraph Listing Algorithms
 
-      for (std::size_t j = i + 1; j < count; ++j) {
-        auto & w1 = wang2[j];
-
-        for (std::size_t k = j + 1; k < count; ++k) {
-          auto & w2 = wang2[k];
+    auto isForward = [this](gf::Id from, gf::Id to) {
+      std::size_t fromDegree = m_neighbors.at(from).size();
+      std::size_t toDegree = m_neighbors.at(to).size();
+      return fromDegree < toDegree || (fromDegree == toDegree && from < to);
+    };
 
-          std::array<AtomId, 6> ids = {
-            w0.borders[0].id, w0.borders[1].id,
-            w1.borders[0].id, w1.borders[1].id,
-            w2.borders[0].id, w2.borders[1].id,
-          };
+    std::vector<std::array<std::size_t, 3>> triangles;
+    std::unordered_map<gf::Id, std::size_t> forward;
 
-          std::sort(ids.begin(), ids.end(), [](const AtomId & lhs, const AtomId & rhs) { return lhs.hash < rhs.hash; });
+    for (auto& [u, neighbors] : m_neighbors) {
+      forward.clear();
 
-          if (ids[0].hash == ids[1].hash && ids[2].hash == ids[3].hash && ids[4].hash == ids[5].hash) {
-            Wang3 wang;
-            wang.ids[0] = ids[0];
-            wang.ids[1] = ids[2];
-            wang.ids[2] = ids[4];
+      for (auto v : neighbors) {
+        if (isForward(u, v)) {
+          forward.emplace(v, m_wang2Index.at(AtomPair(u, v)));
+        }
+      }
 
-            if (wang.ids[0].hash == Void) {
-              std::swap(wang.ids[0], wang.ids[2]);
-            }
+      for (auto& [v, uv] : forward) {
+        for (auto w : m_neighbors.at(v)) {
+          if (!isForward(v, w)) {
+            continue;
+          }
 
-            if (wang.ids[1].hash == Void) {
-              std::swap(wang.ids[1], wang.ids[2]);
-            }
+          auto it = forward.find(w);
 
-            wang3.push_back(wang);
+          if (it != forward.end()) {
+            std::array<std::size_t, 3> sides = { uv, m_wang2Index.at(AtomPair(v, w)), it->second };
+            std::sort(sides.begin(), sides.end(), std::greater<std::size_t>());
+            triangles.push_back(sides);
           }
         }
       }
     }
+
+    // in the order of the last wang2 they come from, so that the wang3 of a new wang2 come after the others, see
+    // addWang3For
+
+    std::sort(triangles.begin(), triangles.end());
+
+    wang3.reserve(triangles.size());
+
+    for (auto& sides : triangles) {
+      wang3.push_back(createTriangleWang3(sides));
+    }
+
+    rebuildWang3Index();
+  }
+
+  void TilesetData::addWang3For(gf::Id id0, gf::Id id1) {
+    if (settings.locked || id0 == id1 || m_wang2Index.count(AtomPair(id0, id1)) == 0) {
+      return;
+    }
+
+    auto it = m_neighbors.find(id0);
+    assert(it != m_neighbors.end());
+
+    for (auto id2 : it->second) {
+      if (id2 == id1 || m_wang2Index.count(AtomPair(id1, id2)) == 0 || m_wang3Index.count(AtomTriple(id0, id1, id2)) > 0) {
+        continue;
+      }
+
+      if (wang3.size() >= static_cast<std::size_t>(settings.maxWang3Count)) {
+        gf::Log::warning("Too many wang3, the wang3 of the new wang2 are not all added\n");
+        return;
+      }
+
+      std::array<std::size_t, 3> sides = { m_wang2Index.at(AtomPair(id0, id1)), m_wang2Index.at(AtomPair(id0, id2)), m_wang2Index.at(AtomPair(id1, id2)) };
+      std::sort(sides.begin(), sides.end(), std::greater<std::size_t>());
+
+      // a new wang2 is the last one, so its wang3 are usually appended
+      auto position = std::upper_bound(wang3.begin(), wang3.end(), sides, [this](const std::array<std::size_t, 3>& value, const Wang3& wang) {
+        return value < getWang3Sides(wang);
+      });
+
+      wang3.insert(position, createTriangleWang3(sides));
+      m_wang3Index.emplace(id0, id1, id2);
+    }
+  }
+
+  void TilesetData::removeWang3For(gf::Id id0, gf::Id id1) {
+    if (settings.locked || id0 == id1) {
+      return;
+    }
+
+    auto it0 = m_neighbors.find(id0);
+    auto it1 = m_neighbors.find(id1);
+
+    if (it0 == m_neighbors.end() || it1 == m_neighbors.end()) {
+      return;
+    }
+
+    // the third atom of a triangle is a neighbor of both atoms
+    const std::vector<gf::Id>& neighbors = it0->second.size() < it1->second.size() ? it0->second : it1->second;
+    gf::Id other = it0->second.size() < it1->second.size() ? id1 : id0;
+    std::vector<AtomTriple> removed;
+
+    for (auto id2 : neighbors) {
+      if (id2 == other || m_wang2Index.count(AtomPair(other, id2)) == 0) {
+        continue;
+      }
+
+      AtomTriple triple(id0, id1, id2);
+
+      if (m_wang3Index.erase(triple) > 0) {
+        removed.push_back(triple);
+      }
+    }
+
+    if (removed.empty()) {
+      return;
+    }
+
+    wang3.erase(std::remove_if(wang3.begin(), wang3.end(), [&removed](const Wang3& wang) {
+      return std::find(removed.begin(), removed.end(), AtomTriple(wang.ids[0].hash, wang.ids[1].hash, wang.ids[2].hash)) != removed.end();
+    }), wang3.end());
+  }
+
+  void TilesetData::rebuildWang3Index() {
+    m_wang3Index.clear();
+
+    for (auto& wang : wang3) {
+      m_wang3Index.emplace(wang.ids[0].hash, wang.ids[1].hash, wang.ids[2].hash);
+    }
+  }
+
+  std::array<std::size_t, 3> TilesetData::getWang3Sides(const Wang3& wang) const {
+    std::array<std::size_t, 3> sides;
+
+    for (std::size_t i = 0; i < 3; ++i) {
+      // a wang3 without one of its wang2 comes last
+      auto it = m_wang2Index.find(AtomPair(wang.ids[i].hash, wang.ids[(i + 1) % 3].hash));
+      sides[i] = it != m_wang2Index.end() ? it->second : std::numeric_limits<std::size_t>::max();
+    }
+
+    std::sort(sides.begin(), sides.end(), std::greater<std::size_t>());
+    return sides;
+  }
+
+  Wang3 TilesetData::createTriangleWang3(const std::array<std::size_t, 3>& sides) const {
+    const Wang2& w0 = wang2[sides[2]];
+    const Wang2& w1 = wang2[sides[1]];
+    gf::Id shared = (w0.borders[0].id.hash == w1.borders[0].id.hash || w0.borders[0].id.hash == w1.borders[1].id.hash) ? w0.borders[0].id.hash : w0.borders[1].id.hash;
+    gf::Id opposite = (w1.borders[0].id.hash == shared) ? w1.borders[1].id.hash : w1.borders[0].id.hash;
+    return createWang3(w0.borders[0].id, w0.borders[1].id, findAtomId(w1, opposite));
+  }
+
+  TilesetData TilesetData::extract(std::initializer_list<gf::Id> ids) const {
+    TilesetData data;
+    data.settings = settings;
+    data.temporary = temporary;
+
+    std::vector<gf::Id> unique;
+
+    for (auto id : ids) {
+      if (std::find(unique.begin(), unique.end(), id) != unique.end()) {
+        continue;
+      }
+
+      // the wang2 with the previous atoms, Void included for the overlays
+      for (auto other : unique) {
+        auto wang = getWang2(id, other, Search::UseDatabaseOnly);
+
+        if (wang != nullptr) {
+          data.wang2.push_back(*wang);
+        }
+      }
+
+      unique.push_back(id);
+      auto it = m_atomIndex.find(id);
+
+      if (it != m_atomIndex.end()) {
+        data.atoms.push_back(atoms[it->second]);
+      }
+    }
+
+    data.rebuildIndex();
+    return data;
   }
 
   /*
@@ -282,6 +410,16 @@ namespace gftools {
     { PigmentStyle::Paved, "paved"},
   })
 
+  NLOHMANN_JSON_SERIALIZE_ENUM( DistanceMetric, {
+    { DistanceMetric::Manhattan, "manhattan" },
+    { DistanceMetric::Euclidean, "euclidean" },
+  })
+
+  NLOHMANN_JSON_SERIALIZE_ENUM( AtlasPacking, {
+    { AtlasPacking::Reserved, "reserved" },
+    { AtlasPacking::Compact, "compact" },
+  })
+
   NLOHMANN_JSON_SERIALIZE_ENUM( BorderEffect, {
     { BorderEffect::None, "none" },
     { BorderEffect::Fade, "fade" },
@@ -303,7 +441,11 @@ namespace gftools {
       { "max_atom_count", settings.maxAtomCount },
       { "max_wang2_count", settings.maxWang2Count },
       { "max_wang3_count", settings.maxWang3Count },
-      { "tile", tile }
+      { "tile", tile },
+      { "metric", settings.metric },
+      { "seed", settings.seed },
+      { "packing", settings.packing },
+      { "power_of_two", settings.powerOfTwo }
     };
   }
 
@@ -314,6 +456,22 @@ namespace gftools {
     j.at("max_wang3_count").get_to(settings.maxWang3Count);
     j.at("tile").at("size").get_to(settings.tile.size);
     j.at("tile").at("spacing").get_to(settings.tile.spacing);
+
+    if (j.contains("metric")) {
+      j.at("metric").get_to(settings.metric);
+    }
+
+    if (j.contains("seed")) {
+      j.at("seed").get_to(settings.seed);
+    }
+
+    if (j.contains("packing")) {
+      j.at("packing").get_to(settings.packing);
+    }
+
+    if (j.contains("power_of_two")) {
+      j.at("power_of_two").get_to(settings.powerOfTwo);
+    }
   }
 
   void to_json(JSON& j, const Pigment& pigment) {
@@ -513,12 +671,39 @@ namespace gftools {
     j.get_to(wang.ids);
   }
 
+  void to_json(JSON& j, const TileSalt& tile) {
+    j = JSON{
+      { "x", tile.position.x },
+      { "y", tile.position.y },
+      { "salt", tile.salt }
+    };
+  }
+
+  void from_json(const JSON& j, TileSalt& tile) {
+    j.at("x").get_to(tile.position.x);
+    j.at("y").get_to(tile.position.y);
+    j.at("salt").get_to(tile.salt);
+  }
+
+  void to_json(JSON& j, const TilesetSalts& salts) {
+    j = JSON{
+      { "ids", salts.ids },
+      { "tiles", salts.tiles }
+    };
+  }
+
+  void from_json(const JSON& j, TilesetSalts& salts) {
+    j.at("ids").get_to(salts.ids);
+    j.at("tiles").get_to(salts.tiles);
+  }
+
   void to_json(JSON& j, const TilesetData& data) {
     j = JSON{
       { "settings", data.settings },
       { "atoms", data.atoms },
       { "wang2", data.wang2 },
-      { "wang3", data.wang3 }
+      { "wang3", data.wang3 },
+      { "salts", data.salts }
     };
   }
 
@@ -527,6 +712,10 @@ namespace gftools {
     j.at("atoms").get_to(data.atoms);
     j.at("wang2").get_to(data.wang2);
     j.at("wang3").get_to(data.wang3);
+
+    if (j.contains("salts")) {
+      j.at("salts").get_to(data.salts);
+    }
   }
 
   TilesetData TilesetData::load(const gf::Path& filename) {
@@ -540,6 +729,8 @@ namespace gftools {
       gf::Log::error("An error occurred while parsing file '%s': %s\n", filename.string().c_str(), ex.what());
     }
 
+    data.rebuildIndex();
+    data.rebuildWang3Index();
     return data;
   }
 
@@ -1,8 +1,14 @@
 #ifndef TILESET_DATA_H
 #define TILESET_DATA_H
 
-#include <vector>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <initializer_list>
 #include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
 
 #include <gf/Id.h>
 #include <gf/Path.h>
@@ -32,14 +38,14 @@ namespace gftools {
     }
   };
 
-  struct ImageFeatures {
-    gf::Vector2i size;
-    int atomsPerLine;
-    int atomsLineCount;
-    int wang2PerLine;
-    int wang2LineCount;
-    int wang3PerLine;
-    int wang3LineCount;
+  enum class DistanceMetric {
+    Manhattan,
+    Euclidean,
+  };
+
+  enum class AtlasPacking {
+    Reserved, // room for the max counts, the tiles keep their ids when the project grows
+    Compact, // only the actual tilesets
   };
 
   struct Settings {
@@ -48,9 +54,10 @@ namespace gftools {
     int maxWang2Count = 48;
     int maxWang3Count = 32;
     TileSettings tile;
-
-    gf::Vector2i getImageSize() const;
-    ImageFeatures getImageFeatures() const;
+    DistanceMetric metric = DistanceMetric::Manhattan;
+    uint32_t seed = 0;
+    AtlasPacking packing = AtlasPacking::Reserved;
+    bool powerOfTwo = false;
   };
 
   enum class PigmentStyle {
@@ -168,6 +175,19 @@ namespace gftools {
     }
   };
 
+  // a tile that was rolled again, its salt is mixed in its random so that the other tiles do not change
+  struct TileSalt {
+    gf::Vector2i position;
+    uint32_t salt = 0;
+  };
+
+  // the tilesets are identified by their atoms: the atom of a plain tileset, the borders of a wang2 or the atoms of
+  // a wang3, in the order of the tileset
+  struct TilesetSalts {
+    std::vector<AtomId> ids;
+    std::vector<TileSalt> tiles;
+  };
+
   constexpr int AtomsTilesetSize = 4;
   constexpr int Wang2TilesetSize = 4;
   constexpr int Wang3TilesetSize = 6;
@@ -178,28 +198,95 @@ namespace gftools {
   };
 
 
+  // unordered pair of atoms
+  struct AtomPair {
+    AtomPair(gf::Id id0, gf::Id id1)
+    : lo(id0 < id1 ? id0 : id1)
+    , hi(id0 < id1 ? id1 : id0)
+    {
+    }
+
+    gf::Id lo;
+    gf::Id hi;
+  };
+
+  inline bool operator==(const AtomPair& lhs, const AtomPair& rhs) {
+    return lhs.lo == rhs.lo && lhs.hi == rhs.hi;
+  }
+
+  struct AtomPairHash {
+    std::size_t operator()(const AtomPair& pair) const {
+      return static_cast<std::size_t>(pair.lo ^ (pair.hi + UINT64_C(0x9E3779B97F4A7C15) + (pair.lo << 6) + (pair.lo >> 2)));
+    }
+  };
+
+  // unordered triple of atoms
+  struct AtomTriple {
+    AtomTriple(gf::Id id0, gf::Id id1, gf::Id id2);
+
+    gf::Id ids[3];
+  };
+
+  inline bool operator==(const AtomTriple& lhs, const AtomTriple& rhs) {
+    return lhs.ids[0] == rhs.ids[0] && lhs.ids[1] == rhs.ids[1] && lhs.ids[2] == rhs.ids[2];
+  }
+
+  struct AtomTripleHash {
+    std::size_t operator()(const AtomTriple& triple) const {
+      AtomPairHash hash;
+      return hash(AtomPair(hash(AtomPair(triple.ids[0], triple.ids[1])), triple.ids[2]));
+    }
+  };
+
   struct TilesetData {
     Settings settings;
     std::vector<Atom> atoms;
     std::vector<Wang2> wang2;
     std::vector<Wang3> wang3;
+    std::vector<TilesetSalts> salts;
 
     struct {
       Atom atom;
       Wang2 wang2;
     } temporary;
 
-    Atom getAtom(gf::Id hash, Search search = Search::UseDatabaseOnly) const;
-    Wang2 getWang2(gf::Id id0, gf::Id id1, Search search = Search::UseDatabaseOnly) const;
+    // must be called after any change in atoms or wang2
+    void rebuildIndex();
+    // must be called after any change in wang3 that is not made by TilesetData
+    void rebuildWang3Index();
+
+    const Atom& getAtom(gf::Id hash, Search search = Search::UseDatabaseOnly) const;
+    // nullptr if there is no wang2 for this pair of atoms
+    const Wang2 *getWang2(gf::Id id0, gf::Id id1, Search search = Search::UseDatabaseOnly) const;
     Edge getEdge(gf::Id id0, gf::Id id1, Search search = Search::UseDatabaseOnly) const;
 
     void updateAtom(Atom oldAtom, Atom newAtom);
     void deleteAtom(gf::Id id);
 
     void generateAllWang3();
+    // incremental versions of generateAllWang3 when the wang2 of (id0, id1) is added or removed, only the wang3 that
+    // have this wang2 on one of their sides are added or removed, in the order of generateAllWang3. The index must
+    // be up to date: add after the wang2 is added, remove before the wang2 is removed. Nothing changes if the
+    // settings are locked, and no wang3 is added beyond the max count of the settings.
+    void addWang3For(gf::Id id0, gf::Id id1);
+    void removeWang3For(gf::Id id0, gf::Id id1);
+
+    // only the settings, the temporary elements, the atoms of ids and the wang2 between them, e.g. for a preview
+    // that must not copy the whole database
+    TilesetData extract(std::initializer_list<gf::Id> ids) const;
 
     static TilesetData load(const gf::Path& filename);
     static void save(const gf::Path& filename, const TilesetData& data);
+
+  private:
+    // the indices of the wang2 of the sides of a triangle, the greatest first
+    std::array<std::size_t, 3> getWang3Sides(const Wang3& wang) const;
+    Wang3 createTriangleWang3(const std::array<std::size_t, 3>& sides) const;
+
+    std::unordered_map<gf::Id, std::size_t> m_atomIndex;
+    std::unordered_map<AtomPair, std::size_t, AtomPairHash> m_wang2Index;
+    std::unordered_map<gf::Id, std::vector<gf::Id>> m_neighbors; // the graph of the atoms defined by wang2
+    std::unordered_set<AtomTriple, AtomTripleHash> m_wang3Index;
   };
 
 }
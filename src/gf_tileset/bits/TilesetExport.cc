@@ -0,0 +1,585 @@
+/*
+ * gf-tools
+ * Copyright (C) 2020 Julien Bernard
+ *
+ * This software is provided 'as-is', without any express or implied
+ * warranty.  In no event will the authors be held liable for any damages
+ * arising from the use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ *    claim that you wrote the original software. If you use this software
+ *    in a product, an acknowledgment in the product documentation would be
+ *    appreciated but is not required.
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ *    misrepresented as being the original software.
+ * 3. This notice may not be removed or altered from any source distribution.
+ */
+#include "TilesetExport.h"
+
+#include <cassert>
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <gf/Clock.h>
+#include <gf/Log.h>
+
+#include "TilesetCache.h"
+#include "TilesetKernels.h"
+#include "TilesetLayout.h"
+#include "TilesetParallel.h"
+#include "TilesetPng.h"
+
+namespace gftools {
+
+  namespace {
+
+    constexpr std::size_t XmlBufferSize = 64 * 1024;
+
+    gf::Path withExtension(gf::Path path, const char *extension) {
+      return path.replace_extension(extension);
+    }
+
+    void convertColors(const Colors& colors, TilesetPixels& pixels) {
+      auto size = colors.data.getSize();
+      std::size_t count = static_cast<std::size_t>(size.width) * size.height;
+      pixels.resize(count * 4);
+      convertToRgba32(colors.data.getDataPtr(), count, pixels.data());
+    }
+
+    bool isSameFences(const Fences& lhs, const Fences& rhs) {
+      if (lhs.count != rhs.count) {
+        return false;
+      }
+
+      for (int i = 0; i < lhs.count; ++i) {
+        if (lhs.segments[i].p0 != rhs.segments[i].p0 || lhs.segments[i].p1 != rhs.segments[i].p1) {
+          return false;
+        }
+      }
+
+      return true;
+    }
+
+    // identical tiles (same pixels, spacing included, same terrain and same fences) are stored once, the
+    // unique tiles are kept in memory until the size of the image is known
+    class TileStore {
+    public:
+      TileStore(gf::Vector2i extendedTileSize)
+      : m_rowSize(static_cast<std::size_t>(extendedTileSize.width) * 4)
+      , m_height(extendedTileSize.height)
+      {
+      }
+
+      uint64_t computeHash(const uint8_t *pixels, std::size_t stride, const Tile& tile) const {
+        uint64_t hash = UINT64_C(0xcbf29ce484222325);
+
+        auto combine = [&hash](uint64_t value) {
+          hash ^= value;
+          hash *= UINT64_C(0x100000001b3);
+        };
+
+        for (int y = 0; y < m_height; ++y) {
+          const uint8_t *row = pixels + y * stride;
+
+          for (std::size_t x = 0; x < m_rowSize; x += 4) {
+            uint32_t value;
+            std::memcpy(&value, row + x, sizeof(uint32_t));
+            combine(value);
+          }
+        }
+
+        for (auto id : tile.terrain) {
+          combine(id);
+        }
+
+        for (int i = 0; i < tile.fences.count; ++i) {
+          auto& segment = tile.fences.segments[i];
+          combine(static_cast<uint32_t>(segment.p0.x) | static_cast<uint64_t>(static_cast<uint32_t>(segment.p0.y)) << 32);
+          combine(static_cast<uint32_t>(segment.p1.x) | static_cast<uint64_t>(static_cast<uint32_t>(segment.p1.y)) << 32);
+        }
+
+        return hash;
+      }
+
+      int add(const uint8_t *pixels, std::size_t stride, const Tile& tile, uint64_t hash) {
+        auto range = m_index.equal_range(hash);
+
+        for (auto it = range.first; it != range.second; ++it) {
+          if (isSame(it->second, pixels, stride, tile)) {
+            return it->second;
+          }
+        }
+
+        int id = static_cast<int>(m_tiles.size());
+        m_tiles.push_back({ tile.terrain, tile.fences });
+        m_index.emplace(hash, id);
+
+        for (int y = 0; y < m_height; ++y) {
+          m_pixels.insert(m_pixels.end(), pixels + y * stride, pixels + y * stride + m_rowSize);
+        }
+
+        return id;
+      }
+
+      std::size_t getCount() const {
+        return m_tiles.size();
+      }
+
+      int getRowCount(int columns) const {
+        return std::max(1, static_cast<int>((m_tiles.size() + columns - 1) / columns));
+      }
+
+      bool write(PngWriter& png, int columns) const {
+        std::size_t tileSize = m_rowSize * m_height;
+        std::size_t imageRowSize = m_rowSize * columns;
+        std::vector<uint8_t> band(imageRowSize * m_height);
+
+        for (std::size_t first = 0; first < m_tiles.size(); first += columns) {
+          std::size_t last = std::min(first + columns, m_tiles.size());
+          std::fill(band.begin(), band.end(), 0);
+
+          for (std::size_t id = first; id < last; ++id) {
+            const uint8_t *source = m_pixels.data() + id * tileSize;
+            uint8_t *destination = band.data() + (id - first) * m_rowSize;
+
+            for (int y = 0; y < m_height; ++y) {
+              std::memcpy(destination + y * imageRowSize, source + y * m_rowSize, m_rowSize);
+            }
+          }
+
+          if (!png.writeRows(band.data(), m_height)) {
+            return false;
+          }
+        }
+
+        if (m_tiles.empty()) {
+          return png.writeEmptyRows(m_height);
+        }
+
+        return true;
+      }
+
+    private:
+      bool isSame(int id, const uint8_t *pixels, std::size_t stride, const Tile& tile) const {
+        auto& stored = m_tiles[id];
+
+        if (stored.terrain != tile.terrain || !isSameFences(stored.fences, tile.fences)) {
+          return false;
+        }
+
+        const uint8_t *source = m_pixels.data() + id * m_rowSize * m_height;
+
+        for (int y = 0; y < m_height; ++y) {
+          if (std::memcmp(source + y * m_rowSize, pixels + y * stride, m_rowSize) != 0) {
+            return false;
+          }
+        }
+
+        return true;
+      }
+
+    private:
+      struct StoredTile {
+        std::array<gf::Id, 4> terrain;
+        Fences fences;
+      };
+
+      std::size_t m_rowSize;
+      int m_height;
+      std::vector<uint8_t> m_pixels;
+      std::vector<StoredTile> m_tiles;
+      std::unordered_multimap<uint64_t, int> m_index;
+    };
+
+    // the mode is read back from the "atlas" property of the tsx, as written by writeTilesetXml
+    bool readAtlasMode(const gf::Path& xmlPath, AtlasMode& mode) {
+      static constexpr char Property[] = "<property name=\"atlas\" value=\"";
+
+      std::ifstream file(xmlPath.string());
+
+      if (!file) {
+        return false;
+      }
+
+      std::string line;
+
+      while (std::getline(file, line)) {
+        auto start = line.find(Property);
+
+        if (start == std::string::npos) {
+          continue;
+        }
+
+        start += sizeof(Property) - 1;
+        auto end = line.find('"', start);
+
+        if (end == std::string::npos) {
+          return false;
+        }
+
+        std::string value = line.substr(start, end - start);
+
+        for (auto candidate : { AtlasMode::Layout, AtlasMode::Deduplicated, AtlasMode::Symmetric }) {
+          if (value == getAtlasModeName(candidate)) {
+            mode = candidate;
+            return true;
+          }
+        }
+
+        return false;
+      }
+
+      return false;
+    }
+
+    // the atlas is generated, colorized and encoded by bands of tilesets of the same line, the pixels of the
+    // tiles are dropped once colorized so that the memory depends on the size of a band, not on the size of
+    // the atlas. Only the tilesets that are not in the cache are generated and colorized. When the tiles are
+    // deduplicated, the unique tiles are kept and the image is written at the end.
+    bool generateAtlas(const TilesetData& db, const gf::Path& imagePath, DecoratedTileset& tilesets, const ExportOptions& options, ExportStats& stats) {
+      gf::Clock clock;
+      std::unique_ptr<TilesetCache> cache;
+
+      // the symmetric tilesets only have their canonical tiles, they do not fit the layout so the ids come from the
+      // deduplication
+      bool deduplicate = options.deduplicate || options.symmetric;
+      tilesets.mode = options.symmetric ? AtlasMode::Symmetric : (options.deduplicate ? AtlasMode::Deduplicated : AtlasMode::Layout);
+
+      if (!options.cache.empty()) {
+        cache = std::make_unique<TilesetCache>(options.cache, db.settings.seed);
+      }
+
+      tilesets.atoms.resize(db.atoms.size(), Tileset({ 0, 0 }));
+      tilesets.wang2.resize(db.wang2.size(), Tileset({ 0, 0 }));
+      tilesets.wang3.resize(db.wang3.size(), Tileset({ 0, 0 }));
+
+      std::size_t count = tilesets.getCount();
+      gf::Vector2i extendedTileSize = db.settings.tile.getExtendedTileSize();
+      AtlasLayout layout = computeAtlasLayout(db);
+      const std::vector<gf::Vector2i>& positions = layout.positions;
+      gf::Vector2i atlasSize = layout.size;
+      std::size_t atlasRowSize = static_cast<std::size_t>(atlasSize.width) * 4;
+      tilesets.imageSize = atlasSize;
+
+      std::vector<uint64_t> keys(count, 0);
+      std::vector<uint64_t> geometryKeys(count, 0);
+
+      // the threads are created once for all the bands and the encoding
+      ThreadPool pool(options.threads);
+      PngWriter png;
+
+      if (!deduplicate && !png.open(imagePath, atlasSize, options.compression, pool)) {
+        gf::Log::error("Could not save the image: '%s'\n", imagePath.string().c_str());
+        return false;
+      }
+
+      std::vector<uint8_t> band;
+      std::vector<TilesetPixels> pixels;
+      std::vector<uint8_t> cached;
+      std::vector<uint8_t> cachedGeometry;
+      std::vector<std::vector<uint64_t>> hashes;
+      int row = 0;
+
+      TileStore store(extendedTileSize);
+      tilesets.tileIds.clear();
+
+      stats.cachedTilesetCount = 0;
+      stats.cachedGeometryCount = 0;
+      stats.allocationCount = 0;
+      stats.arenaBlockCount = 0;
+      clock.restart();
+
+      for (std::size_t first = 0; first < count; ) {
+        std::size_t last = first + 1;
+
+        while (last < count && positions[last].y == positions[first].y) {
+          ++last;
+        }
+
+        std::size_t bandCount = last - first;
+        pixels.assign(bandCount, TilesetPixels());
+        cached.assign(bandCount, 0);
+        cachedGeometry.assign(bandCount, 0);
+        hashes.assign(bandCount, std::vector<uint64_t>());
+
+        parallelFor(pool, bandCount, [&](std::size_t i) {
+          std::size_t index = first + i;
+          Tileset& tileset = tilesets[index];
+          tileset.position = positions[index];
+          bool canonical = options.symmetric && isSymmetricTileset(db, index);
+
+          if (cache) {
+            keys[index] = TilesetCache::computeKey(db, index, canonical);
+            geometryKeys[index] = TilesetCache::computeGeometryKey(db, index, canonical);
+
+            TilesetCache::Shape shape = TilesetCache::computeShape(db, index, canonical);
+
+            if (cache->load(keys[index], shape, tileset, pixels[i])) {
+              cached[i] = 1;
+              return;
+            }
+
+            // only the colors have changed, the tiles are colorized again from the same geometry
+
+            if (cache->loadGeometry(geometryKeys[index], shape, tileset)) {
+              cachedGeometry[i] = 1;
+              return;
+            }
+          }
+
+          tileset = generateTileset(db, index, positions[index], canonical);
+
+          if (cache) {
+            cache->saveGeometry(geometryKeys[index], tileset);
+          }
+        });
+
+        for (std::size_t index = first; index < last; ++index) {
+          if (tilesets[index].arena) {
+            stats.allocationCount += tilesets[index].arena->getAllocationCount();
+            stats.arenaBlockCount += tilesets[index].arena->getBlockCount();
+          }
+        }
+
+        stats.generation += clock.restart();
+
+        int bandTop = positions[first].y * extendedTileSize.height;
+        int bandHeight = 0;
+
+        for (std::size_t index = first; index < last; ++index) {
+          bandHeight = std::max(bandHeight, tilesets[index].tiles.getSize().height * extendedTileSize.height);
+        }
+
+        if (!deduplicate) {
+          band.assign(atlasRowSize * bandHeight, 0);
+        }
+
+        parallelFor(pool, bandCount, [&](std::size_t i) {
+          std::size_t index = first + i;
+          Tileset& tileset = tilesets[index];
+          gf::Vector2i size = tileset.tiles.getSize() * extendedTileSize;
+
+          if (!cached[i]) {
+            Colors colors(size);
+            colorizeTileset(colors.view(), tileset, index, db);
+            convertColors(colors, pixels[i]);
+
+            if (cache) {
+              cache->save(keys[index], tileset, pixels[i]);
+            }
+          }
+
+          tileset.clearPixels();
+
+          std::size_t rowSize = static_cast<std::size_t>(size.width) * 4;
+
+          if (deduplicate) {
+            for (auto position : tileset.tiles.getPositionRange()) {
+              const uint8_t *source = pixels[i].data() + position.y * extendedTileSize.height * rowSize + position.x * extendedTileSize.width * 4;
+              hashes[i].push_back(store.computeHash(source, rowSize, tileset(position)));
+            }
+
+            return;
+          }
+
+          uint8_t *destination = band.data() + static_cast<std::size_t>(tileset.position.x * extendedTileSize.width) * 4;
+
+          for (int y = 0; y < size.height; ++y) {
+            std::memcpy(destination + y * atlasRowSize, pixels[i].data() + y * rowSize, rowSize);
+          }
+
+          pixels[i] = TilesetPixels();
+        });
+
+        stats.cachedTilesetCount += static_cast<std::size_t>(std::count(cached.begin(), cached.end(), 1));
+        stats.cachedGeometryCount += static_cast<std::size_t>(std::count(cachedGeometry.begin(), cachedGeometry.end(), 1));
+        stats.colorization += clock.restart();
+
+        if (deduplicate) {
+          for (std::size_t i = 0; i < bandCount; ++i) {
+            const Tileset& tileset = tilesets[first + i];
+            std::size_t rowSize = static_cast<std::size_t>(tileset.tiles.getSize().width * extendedTileSize.width) * 4;
+            std::size_t next = 0;
+
+            for (auto position : tileset.tiles.getPositionRange()) {
+              const uint8_t *source = pixels[i].data() + position.y * extendedTileSize.height * rowSize + position.x * extendedTileSize.width * 4;
+              tilesets.tileIds.push_back(store.add(source, rowSize, tileset(position), hashes[i][next++]));
+            }
+
+            pixels[i] = TilesetPixels();
+          }
+
+          stats.encoding += clock.restart();
+          first = last;
+          continue;
+        }
+
+        assert(bandTop >= row);
+
+        if (!png.writeEmptyRows(bandTop - row) || !png.writeRows(band.data(), bandHeight)) {
+          gf::Log::error("Could not save the image: '%s'\n", imagePath.string().c_str());
+          return false;
+        }
+
+        row = bandTop + bandHeight;
+        stats.encoding += clock.restart();
+        first = last;
+      }
+
+      if (deduplicate) {
+        int columns = atlasSize.width / extendedTileSize.width;
+        tilesets.imageSize = gf::vec(columns, store.getRowCount(columns)) * extendedTileSize;
+        stats.uniqueTileCount = store.getCount();
+
+        if (!png.open(imagePath, tilesets.imageSize, options.compression, pool) || !store.write(png, columns) || !png.close()) {
+          gf::Log::error("Could not save the image: '%s'\n", imagePath.string().c_str());
+          return false;
+        }
+      } else if (!png.writeEmptyRows(atlasSize.height - row) || !png.close()) {
+        gf::Log::error("Could not save the image: '%s'\n", imagePath.string().c_str());
+        return false;
+      }
+
+      if (cache) {
+        keys.insert(keys.end(), geometryKeys.begin(), geometryKeys.end());
+        cache->prune(keys);
+      }
+
+      stats.encoding += clock.restart();
+      return true;
+    }
+
+  }
+
+  gf::Path getCacheDirectory(const gf::Path& project) {
+    return withExtension(project, ".cache");
+  }
+
+  bool exportTileset(const TilesetData& db, const gf::Path& basename, const ExportOptions& options, ExportStats& stats) {
+    gf::Clock totalClock;
+    gf::Clock clock;
+
+    auto imagePath = withExtension(basename, ".png");
+    DecoratedTileset tilesets;
+
+    if (!generateAtlas(db, imagePath, tilesets, options, stats)) {
+      return false;
+    }
+
+    clock.restart();
+
+    stats.tilesetCount = tilesets.getCount();
+    stats.tileCount = 0;
+
+    for (std::size_t index = 0; index < tilesets.getCount(); ++index) {
+      gf::Vector2i size = tilesets[index].tiles.getSize();
+      stats.tileCount += static_cast<std::size_t>(size.width) * size.height;
+    }
+
+    auto xmlPath = withExtension(basename, ".tsx");
+
+    // the tsx is written as it is generated, through a large buffer
+    std::vector<char> buffer(XmlBufferSize);
+    std::ofstream file;
+    file.rdbuf()->pubsetbuf(buffer.data(), static_cast<std::streamsize>(buffer.size()));
+    file.open(xmlPath.string());
+
+    if (!file) {
+      gf::Log::error("Could not save the tileset: '%s'\n", xmlPath.string().c_str());
+      return false;
+    }
+
+    writeTilesetXml(file, imagePath.filename(), db, tilesets);
+    file.close();
+
+    if (!file) {
+      gf::Log::error("Could not save the tileset: '%s'\n", xmlPath.string().c_str());
+      return false;
+    }
+
+    stats.xml = clock.restart();
+    stats.total = totalClock.getElapsedTime();
+
+    gf::Log::info("Tileset successfully exported in '%s' and '%s'\n", imagePath.string().c_str(), xmlPath.string().c_str());
+    return true;
+  }
+
+  bool patchTileset(const TilesetData& db, const gf::Path& basename, std::size_t index, gf::Vector2i tilePosition, const ExportOptions& options) {
+    gf::Clock clock;
+    auto imagePath = withExtension(basename, ".png");
+
+    if (!std::filesystem::exists(imagePath)) {
+      gf::Log::error("Image does not exists: '%s'\n", imagePath.string().c_str());
+      return false;
+    }
+
+    // the size of the image is not enough, a deduplicated image may have the same size as the layout
+    auto xmlPath = withExtension(basename, ".tsx");
+    AtlasMode mode;
+
+    if (!readAtlasMode(xmlPath, mode)) {
+      gf::Log::error("Could not find the atlas mode in the tileset, export it again: '%s'\n", xmlPath.string().c_str());
+      return false;
+    }
+
+    if (mode != AtlasMode::Layout) {
+      gf::Log::error("The image is %s, only an image exported without --dedup and --symmetric can be patched: '%s'\n", getAtlasModeName(mode), imagePath.string().c_str());
+      return false;
+    }
+
+    gf::Image image;
+
+    try {
+      image = gf::Image(imagePath);
+    } catch (std::exception&) {
+      gf::Log::error("Could not load the image: '%s'\n", imagePath.string().c_str());
+      return false;
+    }
+
+    bool patched = tilePosition.x < 0 ? patchTilesetImage(image, db, index) : patchTileImage(image, db, index, tilePosition);
+
+    if (!patched) {
+      return false;
+    }
+
+    gf::Time generation = clock.restart();
+
+    ThreadPool pool(options.threads);
+    PngWriter png;
+
+    if (!png.open(imagePath, image.getSize(), options.compression, pool) || !png.writeRows(image.getPixelsPtr(), image.getSize().height) || !png.close()) {
+      gf::Log::error("Could not save the image: '%s'\n", imagePath.string().c_str());
+      return false;
+    }
+
+    gf::Log::info("Tileset %zu successfully patched in '%s' (generation: %.3f s, encoding: %.3f s)\n", index, imagePath.string().c_str(), generation.asSeconds(), clock.getElapsedTime().asSeconds());
+    return true;
+  }
+
+  void logExportStats(const ExportStats& stats) {
+    gf::Log::info("Tilesets: %zu (%zu tiles, %zu tilesets from the cache, %zu geometries from the cache)\n", stats.tilesetCount, stats.tileCount, stats.cachedTilesetCount, stats.cachedGeometryCount);
+
+    if (stats.uniqueTileCount > 0) {
+      gf::Log::info("Deduplication: %zu unique tiles (%.1f%% of the tiles)\n", stats.uniqueTileCount, 100.0 * stats.uniqueTileCount / stats.tileCount);
+    }
+
+    gf::Log::info("Generation: %.3f s (%zu tile buffers in %zu arena blocks)\n", stats.generation.asSeconds(), stats.allocationCount, stats.arenaBlockCount);
+    gf::Log::info("Colorization: %.3f s\n", stats.colorization.asSeconds());
+    gf::Log::info("Encoding: %.3f s\n", stats.encoding.asSeconds());
+    gf::Log::info("XML: %.3f s\n", stats.xml.asSeconds());
+
+    float seconds = stats.total.asSeconds();
+    gf::Log::info("Total: %.3f s (%.0f tiles/s)\n", seconds, seconds > 0.0f ? stats.tileCount / seconds : 0.0f);
+  }
+
+}
@@ -0,0 +1,66 @@
+/*
+ * gf-tools
+ * Copyright (C) 2020 Julien Bernard
+ *
+ * This software is provided 'as-is', without any express or implied
+ * warranty.  In no event will the authors be held liable for any damages
+ * arising from the use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ *    claim that you wrote the original software. If you use this software
+ *    in a product, an acknowledgment in the product documentation would be
+ *    appreciated but is not required.
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ *    misrepresented as being the original software.
+ * 3. This notice may not be removed or altered from any source distribution.
+ */
+#ifndef TILESET_EXPORT_H
+#define TILESET_EXPORT_H
+
+#include <cstddef>
+
+#include <gf/Path.h>
+#include <gf/Time.h>
+
+#include "TilesetData.h"
+#include "TilesetProcess.h"
+
+namespace gftools {
+
+  struct ExportStats {
+    std::size_t tilesetCount = 0;
+    std::size_t tileCount = 0;
+    std::size_t cachedTilesetCount = 0;
+    std::size_t cachedGeometryCount = 0; // tilesets that were only colorized
+    std::size_t uniqueTileCount = 0; // only when the tiles are deduplicated
+    std::size_t allocationCount = 0; // buffers of the generated tiles
+    std::size_t arenaBlockCount = 0; // heap allocations behind these buffers
+    gf::Time generation;
+    gf::Time colorization;
+    gf::Time encoding;
+    gf::Time xml;
+    gf::Time total;
+  };
+
+  // <project>.cache next to the project file
+  gf::Path getCacheDirectory(const gf::Path& project);
+
+  // writes <basename>.png and <basename>.tsx
+  bool exportTileset(const TilesetData& db, const gf::Path& basename, const ExportOptions& options, ExportStats& stats);
+
+  // regenerates a tileset, or one of its tiles if the tile position is not negative, in <basename>.png that was
+  // exported without deduplication and without symmetry (see the "atlas" property in <basename>.tsx), the rest of
+  // the image is kept as is. Only the generation of the other tilesets is saved: the whole png is decoded and
+  // encoded again, which costs about as much as the encoding of a full export (use a low compression level for
+  // fast iterations)
+  bool patchTileset(const TilesetData& db, const gf::Path& basename, std::size_t index, gf::Vector2i tilePosition, const ExportOptions& options);
+
+  void logExportStats(const ExportStats& stats);
+
+}
+
+#endif // TILESET_EXPORT_H
@@ -20,11 +20,14 @@
  */
 #include "TilesetGeneration.h"
 
+#include <cstdlib>
 #include <algorithm>
-#include <queue>
+#include <map>
+#include <mutex>
+#include <utility>
+#include <vector>
 
 #include <gf/Color.h>
-#include <gf/Geometry.h>
 #include <gf/Log.h>
 #include <gf/Span.h>
 #include <gf/VectorOps.h>
@@ -32,56 +35,235 @@
 namespace gftools {
 
   /*
-   * Pixels
+   * LabelGrid
    */
 
-  Pixels::Pixels(gf::Vector2i size, gf::Id biome)
-  : data(size, biome)
+  LabelGrid::LabelGrid(gf::Vector2i size, uint8_t value)
+  : m_resource(TileArena::getCurrent())
+  , m_size(size)
+  , m_unassignedCount(value == Unassigned ? static_cast<int>(getCount()) : 0)
+  {
+    m_labels = static_cast<uint8_t *>(m_resource->allocate(getCount(), 1));
+    std::fill(m_labels, m_labels + getCount(), value);
+  }
+
+  LabelGrid::LabelGrid(const LabelGrid& other)
+  : m_size(other.m_size)
+  , m_unassignedCount(other.m_unassignedCount)
+  {
+    if (other.m_labels != nullptr) {
+      m_resource = std::pmr::get_default_resource();
+      m_labels = static_cast<uint8_t *>(m_resource->allocate(getCount(), 1));
+      std::copy(other.getDataPtr(), other.getDataPtr() + getCount(), m_labels);
+    }
+  }
+
+  LabelGrid::LabelGrid(LabelGrid&& other) noexcept
+  : m_resource(std::exchange(other.m_resource, nullptr))
+  , m_labels(std::exchange(other.m_labels, nullptr))
+  , m_size(std::exchange(other.m_size, gf::vec(0, 0)))
+  , m_unassignedCount(std::exchange(other.m_unassignedCount, 0))
   {
   }
 
-  void Pixels::fillFrom(gf::Vector2i start, gf::Id biome) {
-    data(start) = biome;
+  LabelGrid::~LabelGrid() {
+    release();
+  }
 
-    std::queue<gf::Vector2i> q;
-    q.push(start);
+  LabelGrid& LabelGrid::operator=(const LabelGrid& other) {
+    if (this != &other) {
+      *this = LabelGrid(other);
+    }
 
-    while (!q.empty()) {
-      auto curr = q.front();
+    return *this;
+  }
 
-      assert(data(curr) == biome);
+  LabelGrid& LabelGrid::operator=(LabelGrid&& other) noexcept {
+    if (this != &other) {
+      release();
+      m_resource = std::exchange(other.m_resource, nullptr);
+      m_labels = std::exchange(other.m_labels, nullptr);
+      m_size = std::exchange(other.m_size, gf::vec(0, 0));
+      m_unassignedCount = std::exchange(other.m_unassignedCount, 0);
+    }
+
+    return *this;
+  }
 
-      for (auto next : data.get4NeighborsRange(curr)) {
-        if (data(next) == gf::InvalidId) {
-          data(next) = biome;
-          q.push(next);
+  void LabelGrid::setLabels(const uint8_t *labels) {
+    std::copy(labels, labels + getCount(), m_labels);
+    m_unassignedCount = static_cast<int>(std::count(m_labels, m_labels + getCount(), Unassigned));
+  }
+
+  LabelGrid::NeighborRange LabelGrid::get4NeighborsRange(gf::Vector2i pos) const {
+    static constexpr gf::Vector2i Offsets[] = { { 0, -1 }, { -1, 0 }, { 1, 0 }, { 0, 1 } };
+    NeighborRange range;
+
+    for (auto offset : Offsets) {
+      gf::Vector2i neighbor = pos + offset;
+
+      if (isValid(neighbor)) {
+        range.positions[range.count++] = neighbor;
+      }
+    }
+
+    return range;
+  }
+
+  LabelGrid::NeighborRange LabelGrid::get8NeighborsRange(gf::Vector2i pos) const {
+    NeighborRange range;
+
+    for (int dy = -1; dy <= 1; ++dy) {
+      for (int dx = -1; dx <= 1; ++dx) {
+        gf::Vector2i neighbor = pos + gf::vec(dx, dy);
+
+        if ((dx != 0 || dy != 0) && isValid(neighbor)) {
+          range.positions[range.count++] = neighbor;
         }
       }
+    }
+
+    return range;
+  }
+
+  void LabelGrid::fillFrom(gf::Vector2i start, uint8_t label) {
+    // span filling, see Heckbert, A Seed Fill Algorithm, Graphics Gems
+    auto size = m_size;
+    int filled = 0;
+
+    auto fill = [&](uint8_t& pixel) {
+      pixel = label;
+      ++filled;
+    };
+
+    uint8_t& first = m_labels[start.y * size.width + start.x];
+
+    if (first == Unassigned) {
+      ++filled;
+    }
+
+    first = label;
+
+    // each seed is already filled, the stack is kept between calls
+    static thread_local std::vector<gf::Vector2i> stack;
+    stack.clear();
+    stack.push_back(start);
+
+    while (!stack.empty()) {
+      auto seed = stack.back();
+      stack.pop_back();
+
+      uint8_t *row = m_labels + seed.y * size.width;
+
+      int left = seed.x;
+
+      while (left > 0 && row[left - 1] == Unassigned) {
+        fill(row[--left]);
+      }
+
+      int right = seed.x;
 
-      q.pop();
+      while (right + 1 < size.width && row[right + 1] == Unassigned) {
+        fill(row[++right]);
+      }
+
+      for (int dy : { -1, 1 }) {
+        int y = seed.y + dy;
+
+        if (y < 0 || y >= size.height) {
+          continue;
+        }
+
+        uint8_t *next = row + dy * size.width;
+        bool inSpan = false;
+
+        for (int x = left; x <= right; ++x) {
+          if (next[x] != Unassigned) {
+            inSpan = false;
+            continue;
+          }
+
+          if (!inSpan) {
+            fill(next[x]);
+            stack.push_back({ x, y });
+            inSpan = true;
+          }
+        }
+      }
     }
+
+    m_unassignedCount -= filled;
   }
 
-  void Pixels::checkHoles() {
-    for (auto pos : data.getPositionRange()) {
-      gf::Id id = data(pos);
+  void LabelGrid::fillHoles() {
+    for (auto pos : getPositionRange()) {
+      if (m_unassignedCount == 0) {
+        break;
+      }
 
-      if (id == gf::InvalidId) {
-        auto& invalid = data(pos);
+      uint8_t& label = m_labels[pos.y * m_size.width + pos.x];
 
-        for (auto next : data.get8NeighborsRange(pos)) {
-          gf::Id nextBiome = data(next);
+      if (label == Unassigned) {
+        for (auto next : get8NeighborsRange(pos)) {
+          uint8_t nextLabel = (*this)(next);
 
-          if (nextBiome != gf::InvalidId) {
-            invalid = nextBiome;
+          if (nextLabel != Unassigned) {
+            label = nextLabel;
           }
         }
+
+        if (label != Unassigned) {
+          --m_unassignedCount;
+        }
       }
 
-      assert(data(pos) != gf::InvalidId);
+      assert((*this)(pos) != Unassigned);
     }
   }
 
+  void LabelGrid::release() {
+    if (m_labels != nullptr) {
+      m_resource->deallocate(m_labels, getCount(), 1);
+      m_labels = nullptr;
+    }
+  }
+
+  /*
+   * Pixels
+   */
+
+  Pixels::Pixels(gf::Vector2i size, gf::Id biome) {
+    data = LabelGrid(size, biome != gf::InvalidId ? addLabel(biome) : Unassigned);
+  }
+
+  uint8_t Pixels::getLabel(gf::Id biome) const {
+    for (std::size_t i = 0; i < PaletteSize; ++i) {
+      if (palette[i] == biome) {
+        return static_cast<uint8_t>(i);
+      }
+    }
+
+    return NoLabel;
+  }
+
+  uint8_t Pixels::addLabel(gf::Id biome) {
+    uint8_t label = getLabel(biome);
+
+    if (label != NoLabel) {
+      return label;
+    }
+
+    for (std::size_t i = Unassigned + 1; i < PaletteSize; ++i) {
+      if (palette[i] == gf::InvalidId) {
+        palette[i] = biome;
+        return static_cast<uint8_t>(i);
+      }
+    }
+
+    gf::Log::error("Too many biomes in a tile\n");
+    assert(false);
+    return Unassigned;
+  }
 
   /*
    * Tile
@@ -102,6 +284,47 @@ namespace gftools {
   {
   }
 
+  Tileset::Tileset(const Tileset& other)
+  : tiles(other.tiles)
+  , position(other.position)
+  {
+  }
+
+  Tileset::Tileset(Tileset&& other) noexcept
+  : arena(std::move(other.arena))
+  , tiles(std::move(other.tiles))
+  , position(other.position)
+  {
+  }
+
+  Tileset& Tileset::operator=(const Tileset& other) {
+    if (this != &other) {
+      tiles = other.tiles;
+      arena = nullptr;
+      position = other.position;
+    }
+
+    return *this;
+  }
+
+  Tileset& Tileset::operator=(Tileset&& other) noexcept {
+    if (this != &other) {
+      tiles = std::move(other.tiles);
+      arena = std::move(other.arena);
+      position = other.position;
+    }
+
+    return *this;
+  }
+
+  void Tileset::clearPixels() {
+    for (auto& tile : tiles) {
+      tile.pixels = Pixels();
+    }
+
+    arena = nullptr;
+  }
+
   /*
    * Tiles generators
    */
@@ -156,37 +379,71 @@ namespace gftools {
       return { settings.size - 1, settings.size - 1 };
     }
 
-    std::vector<gf::Vector2i> makeLine(const TileSettings& settings, gf::Span<const gf::Vector2i> points, gf::Random& random, const Displacement& displacement) {
-      // generate random line points
+    // more iterations than the pixels of any tile
+    constexpr int MaxDisplacementIterations = 8;
 
-      std::vector<gf::Vector2i> tmp;
+    // Bresenham, without the last point
+    void drawSegment(Pixels& pixels, gf::Vector2i p0, gf::Vector2i p1, gf::Id biome) {
+      int dx = std::abs(p1.x - p0.x);
+      int dy = -std::abs(p1.y - p0.y);
+      int sx = p0.x < p1.x ? 1 : -1;
+      int sy = p0.y < p1.y ? 1 : -1;
+      int error = dx + dy;
 
-      for (std::size_t i = 0; i < points.getSize() - 1; ++i) {
-        auto line = gf::midpointDisplacement1D(points[i], points[i + 1], random, displacement.iterations, displacement.initial, displacement.reduction);
-        tmp.insert(tmp.end(), line.begin(), line.end());
-        tmp.pop_back();
+      while (p0 != p1) {
+        pixels(p0) = biome;
+        int error2 = 2 * error;
+
+        if (error2 >= dy) {
+          error += dy;
+          p0.x += sx;
+        }
+
+        if (error2 <= dx) {
+          error += dx;
+          p0.y += sy;
+        }
       }
+    }
 
-      tmp.push_back(points[points.getSize() - 1]);
+    // random line through the points, drawn directly in the pixels without any allocation
+    void drawLine(Pixels& pixels, const TileSettings& settings, gf::Span<const gf::Vector2i> points, gf::Random& random, const Displacement& displacement, gf::Id biome) {
+      int iterations = gf::clamp(displacement.iterations, 0, MaxDisplacementIterations);
+      std::size_t size = std::size_t(1) << iterations;
+      gf::Vector2f line[(std::size_t(1) << MaxDisplacementIterations) + 1];
 
-      // normalize
+      for (std::size_t i = 0; i < points.getSize() - 1; ++i) {
+        // midpoint displacement, see gf::midpointDisplacement1D
 
-      for (auto& point : tmp) {
-        point = gf::clamp(point, 0, settings.size - 1);
-      }
+        gf::Vector2f p0(points[i]);
+        gf::Vector2f p1(points[i + 1]);
+        gf::Vector2f direction = gf::perp(p1 - p0);
 
-      // compute final line
+        line[0] = p0;
+        line[size] = p1;
 
-      std::vector<gf::Vector2i> out;
+        float factor = displacement.initial;
 
-      for (std::size_t i = 0; i < tmp.size() - 1; ++i) {
-        auto line = gf::generateLine(tmp[i], tmp[i + 1]);
-        out.insert(out.end(), line.begin(), line.end());
-      }
+        for (std::size_t step = size / 2; step > 0; step /= 2) {
+          for (std::size_t j = step; j < size; j += 2 * step) {
+            line[j] = (line[j - step] + line[j + step]) / 2.0f + random.computeUniformFloat(-factor, factor) * direction;
+          }
+
+          factor *= displacement.reduction;
+        }
+
+        // normalize and draw
 
-      out.push_back(points[points.getSize() - 1]);
+        gf::Vector2i previous = gf::clamp(gf::Vector2i(line[0]), 0, settings.size - 1);
 
-      return out;
+        for (std::size_t j = 1; j <= size; ++j) {
+          gf::Vector2i current = gf::clamp(gf::Vector2i(line[j]), 0, settings.size - 1);
+          drawSegment(pixels, previous, current, biome);
+          previous = current;
+        }
+      }
+
+      pixels(points[points.getSize() - 1]) = biome;
     }
 
   }
@@ -222,11 +479,7 @@ namespace gftools {
         break;
     }
 
-    auto line = makeLine(settings, endPoints, random, edge.displacement);
-
-    for (auto point : line) {
-      tile.pixels(point) = b1;
-    }
+    drawLine(tile.pixels, settings, endPoints, random, edge.displacement, b1);
 
     tile.pixels.fillFrom(cornerTopLeft(settings), b0);
     tile.pixels.fillFrom(cornerBottomRight(settings), b1);
@@ -289,11 +542,7 @@ namespace gftools {
         break;
     }
 
-    auto line = makeLine(settings, endPoints, random, edge.displacement);
-
-    for (auto point : line) {
-      tile.pixels(point) = b0;
-    }
+    drawLine(tile.pixels, settings, endPoints, random, edge.displacement, b0);
 
     switch (c) {
       case Corner::TopLeft:
@@ -367,19 +616,11 @@ namespace gftools {
 
     gf::Vector2i limitTopRight[] = { top(settings, half + edge.offset), { half, half - 1 }, right(settings, half - 1 - edge.offset) };
 
-    auto lineTopRight = makeLine(settings, limitTopRight, random, edge.displacement);
-
-    for (auto point : lineTopRight) {
-      tile.pixels(point) = b1;
-    }
+    drawLine(tile.pixels, settings, limitTopRight, random, edge.displacement, b1);
 
     gf::Vector2i limitBottomLeft[] = { bottom(settings, half - 1 - edge.offset), { half - 1, half }, left(settings, half + edge.offset) };
 
-    auto lineBottomLeft = makeLine(settings, limitBottomLeft, random, edge.displacement);
-
-    for (auto point : lineBottomLeft) {
-      tile.pixels(point) = b1;
-    }
+    drawLine(tile.pixels, settings, limitBottomLeft, random, edge.displacement, b1);
 
     tile.pixels.fillFrom(cornerTopLeft(settings), b0);
     tile.pixels.fillFrom(cornerBottomRight(settings), b0);
@@ -435,25 +676,13 @@ namespace gftools {
     }
 
     gf::Vector2i segmentMiddle[] = { p2, p3 };
-    auto lineMiddle = makeLine(settings, segmentMiddle, random, e12.displacement);
-
-    for (auto point : lineMiddle) {
-      tile.pixels(point) = b2;
-    }
+    drawLine(tile.pixels, settings, segmentMiddle, random, e12.displacement, b2);
 
     gf::Vector2i segmentLeft[] = { p0, p2 };
-    auto lineLeft = makeLine(settings, segmentLeft, random, e01.displacement);
-
-    for (auto point : lineLeft) {
-      tile.pixels(point) = b0;
-    }
+    drawLine(tile.pixels, settings, segmentLeft, random, e01.displacement, b0);
 
     gf::Vector2i segmentRight[] = { p1, p2 };
-    auto lineRight = makeLine(settings, segmentRight, random, e20.displacement);
-
-    for (auto point : lineRight) {
-      tile.pixels(point) = b0;
-    }
+    drawLine(tile.pixels, settings, segmentRight, random, e20.displacement, b0);
 
     if (split == HSplit::Top) {
       tile.pixels.fillFrom(top(settings, half), b0);
@@ -541,25 +770,13 @@ namespace gftools {
     }
 
     gf::Vector2i segmentMiddle[] = { p2, p3 };
-    auto lineMiddle = makeLine(settings, segmentMiddle, random, e12.displacement);
-
-    for (auto point : lineMiddle) {
-      tile.pixels(point) = b2;
-    }
+    drawLine(tile.pixels, settings, segmentMiddle, random, e12.displacement, b2);
 
     gf::Vector2i segmentTop[] = { p0, p2 };
-    auto lineTop = makeLine(settings, segmentTop, random, e01.displacement);
-
-    for (auto point : lineTop) {
-      tile.pixels(point) = b0;
-    }
+    drawLine(tile.pixels, settings, segmentTop, random, e01.displacement, b0);
 
     gf::Vector2i segmentBottom[] = { p1, p2 };
-    auto lineBottom = makeLine(settings, segmentBottom, random, e20.displacement);
-
-    for (auto point : lineBottom) {
-      tile.pixels(point) = b0;
-    }
+    drawLine(tile.pixels, settings, segmentBottom, random, e20.displacement, b0);
 
     if (split == VSplit::Left) {
       tile.pixels.fillFrom(left(settings, half), b0);
@@ -647,18 +864,10 @@ namespace gftools {
     }
 
     gf::Vector2i segmentLeft[] = { p0, p1 };
-    auto lineLeft = makeLine(settings, segmentLeft, random, e01.displacement);
-
-    for (auto point : lineLeft) {
-      tile.pixels(point) = b0;
-    }
+    drawLine(tile.pixels, settings, segmentLeft, random, e01.displacement, b0);
 
     gf::Vector2i segmentRight[] = { p2, p3 };
-    auto lineRight = makeLine(settings, segmentRight, random, e20.displacement);
-
-    for (auto point : lineRight) {
-      tile.pixels(point) = b0;
-    }
+    drawLine(tile.pixels, settings, segmentRight, random, e20.displacement, b0);
 
     if (oblique == Oblique::Up) {
       tile.pixels.fillFrom(cornerBottomLeft(settings), b0);
@@ -708,6 +917,37 @@ namespace gftools {
     return tile;
   }
 
+  /*
+   * TileRandom
+   */
+
+  gf::Random TileRandom::operator()(gf::Vector2i position) const {
+    uint64_t counter = static_cast<uint64_t>(static_cast<uint32_t>(position.x)) << 32 | static_cast<uint32_t>(position.y);
+    uint64_t state = mix(m_key ^ mix(counter));
+
+    for (auto& tile : m_salts) {
+      if (tile.position == position && tile.salt != 0) {
+        state = mix(state ^ tile.salt);
+        break;
+      }
+    }
+
+    return gf::Random(static_cast<uint32_t>(state ^ (state >> 32)));
+  }
+
+  bool TileRandom::hasSalt(gf::Vector2i position) const {
+    return std::any_of(m_salts.begin(), m_salts.end(), [position](const TileSalt& tile) {
+      return tile.position == position && tile.salt != 0;
+    });
+  }
+
+  uint64_t TileRandom::mix(uint64_t x) {
+    x += UINT64_C(0x9E3779B97F4A7C15);
+    x = (x ^ (x >> 30)) * UINT64_C(0xBF58476D1CE4E5B9);
+    x = (x ^ (x >> 27)) * UINT64_C(0x94D049BB133111EB);
+    return x ^ (x >> 31);
+  }
+
   /*
    * Plain
    */
@@ -744,33 +984,174 @@ namespace gftools {
    *    b1 = '#'
    */
 
-  Tileset generateTwoCornersWangTileset(const Wang2& wang, gf::Random& random, const TilesetData& db) {
-    Tileset tileset({ Wang2TilesetSize, Wang2TilesetSize });
-
+  Tile generateTwoCornersWangTile(const Wang2& wang, gf::Vector2i position, gf::Random& random, const TilesetData& db) {
     auto b0 = wang.borders[0].id.hash;
     auto b1 = wang.borders[1].id.hash;
     auto edge = wang.edge;
     auto& settings = db.settings.tile;
 
-    tileset({ 0, 0 }) = generateCorner(settings, b1, b0, Corner::BottomLeft, random, edge.invert());
-    tileset({ 0, 1 }) = generateCross(settings, b1, b0, random, edge.invert());
-    tileset({ 0, 2 }) = generateCorner(settings, b1, b0, Corner::TopRight, random, edge.invert());
-    tileset({ 0, 3 }) = generateFull(settings, b0);
+    switch (position.x * Wang2TilesetSize + position.y) {
+      case 0 * Wang2TilesetSize + 0: return generateCorner(settings, b1, b0, Corner::BottomLeft, random, edge.invert());
+      case 0 * Wang2TilesetSize + 1: return generateCross(settings, b1, b0, random, edge.invert());
+      case 0 * Wang2TilesetSize + 2: return generateCorner(settings, b1, b0, Corner::TopRight, random, edge.invert());
+      case 0 * Wang2TilesetSize + 3: return generateFull(settings, b0);
+
+      case 1 * Wang2TilesetSize + 0: return generateSplit(settings, b0, b1, Split::Vertical, random, edge);
+      case 1 * Wang2TilesetSize + 1: return generateCorner(settings, b0, b1, Corner::TopLeft, random, edge);
+      case 1 * Wang2TilesetSize + 2: return generateSplit(settings, b1, b0, Split::Horizontal, random, edge.invert());
+      case 1 * Wang2TilesetSize + 3: return generateCorner(settings, b1, b0, Corner::BottomRight, random, edge.invert());
+
+      case 2 * Wang2TilesetSize + 0: return generateCorner(settings, b0, b1, Corner::TopRight, random, edge);
+      case 2 * Wang2TilesetSize + 1: return generateFull(settings, b1);
+      case 2 * Wang2TilesetSize + 2: return generateCorner(settings, b0, b1, Corner::BottomLeft, random, edge);
+      case 2 * Wang2TilesetSize + 3: return generateCross(settings, b0, b1, random, edge);
+
+      case 3 * Wang2TilesetSize + 0: return generateSplit(settings, b0, b1, Split::Horizontal, random, edge);
+      case 3 * Wang2TilesetSize + 1: return generateCorner(settings, b0, b1, Corner::BottomRight, random, edge);
+      case 3 * Wang2TilesetSize + 2: return generateSplit(settings, b1, b0, Split::Vertical, random, edge.invert());
+      case 3 * Wang2TilesetSize + 3: return generateCorner(settings, b1, b0, Corner::TopLeft, random, edge.invert());
+    }
 
-    tileset({ 1, 0 }) = generateSplit(settings, b0, b1, Split::Vertical, random, edge);
-    tileset({ 1, 1 }) = generateCorner(settings, b0, b1, Corner::TopLeft, random, edge);
-    tileset({ 1, 2 }) = generateSplit(settings, b1, b0, Split::Horizontal, random, edge.invert());
-    tileset({ 1, 3 }) = generateCorner(settings, b1, b0, Corner::BottomRight, random, edge.invert());
+    assert(false);
+    return generateFull(settings, b0);
+  }
 
-    tileset({ 2, 0 }) = generateCorner(settings, b0, b1, Corner::TopRight, random, edge);
-    tileset({ 2, 1 }) = generateFull(settings, b1);
-    tileset({ 2, 2 }) = generateCorner(settings, b0, b1, Corner::BottomLeft, random, edge);
-    tileset({ 2, 3 }) = generateCross(settings, b0, b1, random, edge);
+  Tileset generateTwoCornersWangTileset(const Wang2& wang, const TileRandom& random, const TilesetData& db) {
+    Tileset tileset({ Wang2TilesetSize, Wang2TilesetSize });
 
-    tileset({ 3, 0 }) = generateSplit(settings, b0, b1, Split::Horizontal, random, edge);
-    tileset({ 3, 1 }) = generateCorner(settings, b0, b1, Corner::BottomRight, random, edge);
-    tileset({ 3, 2 }) = generateSplit(settings, b1, b0, Split::Vertical, random, edge.invert());
-    tileset({ 3, 3 }) = generateCorner(settings, b1, b0, Corner::TopLeft, random, edge.invert());
+    for (auto position : tileset.tiles.getPositionRange()) {
+      gf::Random tileRandom = random(position);
+      tileset(position) = generateTwoCornersWangTile(wang, position, tileRandom, db);
+    }
+
+    return tileset;
+  }
+
+  namespace {
+
+    struct Wang2Symmetry {
+      int x; // the canonical tile
+      int y;
+      bool diagonal; // the flips of Tiled, in this order
+      bool horizontal;
+      bool vertical;
+    };
+
+    // the canonical tiles are (0, 3) and (2, 1) for the full tiles, (1, 1) and (3, 3) for the corners, (3, 0)
+    // for the split and (2, 3) for the cross, the symmetry of (x, y) is at x * Wang2TilesetSize + y
+    constexpr Wang2Symmetry Wang2Symmetries[Wang2TilesetSize * Wang2TilesetSize] = {
+      { 3, 3, false, false, true  }, { 2, 3, false, true,  false }, { 3, 3, false, true,  false }, { 0, 3, false, false, false },
+      { 3, 0, true,  false, false }, { 1, 1, false, false, false }, { 3, 0, false, false, true  }, { 3, 3, false, true,  true  },
+      { 1, 1, false, true,  false }, { 2, 1, false, false, false }, { 1, 1, false, false, true  }, { 2, 3, false, false, false },
+      { 3, 0, false, false, false }, { 1, 1, false, true,  true  }, { 3, 0, true,  true,  false }, { 3, 3, false, false, false },
+    };
+
+    bool isCanonical(const Wang2Symmetry& symmetry, gf::Vector2i position) {
+      return symmetry.x == position.x && symmetry.y == position.y;
+    }
+
+    // the pixel of the canonical tile that is seen at the position in the flipped tile
+    gf::Vector2i getFlippedPosition(const Wang2Symmetry& symmetry, gf::Vector2i position, int size) {
+      if (symmetry.vertical) {
+        position.y = size - 1 - position.y;
+      }
+
+      if (symmetry.horizontal) {
+        position.x = size - 1 - position.x;
+      }
+
+      if (symmetry.diagonal) {
+        std::swap(position.x, position.y);
+      }
+
+      return position;
+    }
+
+    uint16_t checkTwoCornersWangSymmetries(const Wang2& wang, const TilesetData& db) {
+      // the random is not used without displacement
+      Wang2 straight = wang;
+      straight.edge.displacement.iterations = 0;
+      gf::Random random(0);
+
+      int size = db.settings.tile.size;
+      TileArena arena(static_cast<std::size_t>(Wang2TilesetSize * Wang2TilesetSize * 2 * size * size));
+      TileArena::Scope scope(arena);
+
+      uint16_t symmetries = 0;
+
+      for (int x = 0; x < Wang2TilesetSize; ++x) {
+        for (int y = 0; y < Wang2TilesetSize; ++y) {
+          const Wang2Symmetry& symmetry = Wang2Symmetries[x * Wang2TilesetSize + y];
+
+          if (isCanonical(symmetry, gf::vec(x, y))) {
+            continue;
+          }
+
+          Tile canonical = generateTwoCornersWangTile(straight, gf::vec(symmetry.x, symmetry.y), random, db);
+          Tile tile = generateTwoCornersWangTile(straight, gf::vec(x, y), random, db);
+          bool exact = true;
+
+          for (auto position : tile.pixels.data.getPositionRange()) {
+            if (gf::Id(tile.pixels(position)) != gf::Id(canonical.pixels(getFlippedPosition(symmetry, position, size)))) {
+              exact = false;
+              break;
+            }
+          }
+
+          if (exact) {
+            symmetries |= 1 << (x * Wang2TilesetSize + y);
+          }
+        }
+      }
+
+      return symmetries;
+    }
+
+  }
+
+  uint16_t computeTwoCornersWangSymmetries(const Wang2& wang, const TilesetData& db) {
+    // few different offsets in a project, each check is done once
+    static std::mutex mutex;
+    static std::map<std::pair<int, int>, uint16_t> symmetries;
+
+    std::pair<int, int> key(db.settings.tile.size, wang.edge.offset);
+
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      auto it = symmetries.find(key);
+
+      if (it != symmetries.end()) {
+        return it->second;
+      }
+    }
+
+    uint16_t result = checkTwoCornersWangSymmetries(wang, db);
+
+    std::lock_guard<std::mutex> lock(mutex);
+    symmetries.emplace(key, result);
+    return result;
+  }
+
+  Tileset generateCanonicalTwoCornersWangTileset(const Wang2& wang, const TileRandom& random, const TilesetData& db) {
+    uint16_t symmetries = computeTwoCornersWangSymmetries(wang, db);
+    std::vector<gf::Vector2i> positions;
+
+    for (int x = 0; x < Wang2TilesetSize; ++x) {
+      for (int y = 0; y < Wang2TilesetSize; ++y) {
+        // a tile that was rolled again is no longer a flip of its canonical tile
+        if ((symmetries & (1 << (x * Wang2TilesetSize + y))) == 0 || random.hasSalt(gf::vec(x, y))) {
+          positions.push_back(gf::vec(x, y));
+        }
+      }
+    }
+
+    Tileset tileset(gf::vec(static_cast<int>(positions.size()), 1));
+
+    for (std::size_t i = 0; i < positions.size(); ++i) {
+      // the random of the position in the full tileset
+      gf::Random tileRandom = random(positions[i]);
+      tileset(gf::vec(static_cast<int>(i), 0)) = generateTwoCornersWangTile(wang, positions[i], tileRandom, db);
+    }
 
     return tileset;
   }
@@ -803,9 +1184,7 @@ namespace gftools {
    *   b2 = '#'
    */
 
-  Tileset generateThreeCornersWangTileset(const Wang3& wang, gf::Random& random, const TilesetData& db) {
-    Tileset tileset({ Wang3TilesetSize, Wang3TilesetSize });
-
+  Tile generateThreeCornersWangTile(const Wang3& wang, gf::Vector2i position, gf::Random& random, const TilesetData& db) {
     gf::Id b0 = wang.ids[0].hash;
     gf::Id b1 = wang.ids[1].hash;
     gf::Id b2 = wang.ids[2].hash;
@@ -814,47 +1193,61 @@ namespace gftools {
     Edge edge12 = db.getEdge(b1, b2);
     Edge edge20 = db.getEdge(b2, b0);
 
-    tileset({ 0, 0 }) = generateHorizontalSplit(db.settings.tile, b2, b1, b0, HSplit::Top, random, edge12.invert(), edge01.invert(), edge20.invert());
-    tileset({ 0, 1 }) = generateVerticalSplit(db.settings.tile, b1, b0, b2, VSplit::Left, random, edge01.invert(), edge20.invert(), edge12.invert());
-    tileset({ 0, 2 }) = generateOblique(db.settings.tile, b1, b0, b2, Oblique::Down, random, edge01.invert(), edge12.invert());
-    tileset({ 0, 3 }) = generateOblique(db.settings.tile, b1, b0, b2, Oblique::Up, random, edge01.invert(), edge12.invert());
-    tileset({ 0, 4 }) = generateVerticalSplit(db.settings.tile, b1, b2, b0, VSplit::Left, random, edge12, edge20, edge01);
-    tileset({ 0, 5 }) = generateHorizontalSplit(db.settings.tile, b2, b1, b0, HSplit::Bottom, random, edge12.invert(), edge01.invert(), edge20.invert());
-
-    tileset({ 1, 0 }) = generateHorizontalSplit(db.settings.tile, b2, b0, b1, HSplit::Top, random, edge20, edge01, edge12);
-    tileset({ 1, 1 }) = generateOblique(db.settings.tile, b0, b2, b1, Oblique::Down, random, edge20.invert(), edge01.invert());
-    tileset({ 1, 2 }) = generateHorizontalSplit(db.settings.tile, b1, b2, b0, HSplit::Bottom, random, edge12, edge20, edge01);
-    tileset({ 1, 3 }) = generateHorizontalSplit(db.settings.tile, b1, b2, b0, HSplit::Top, random, edge12, edge20, edge01);
-    tileset({ 1, 4 }) = generateOblique(db.settings.tile, b0, b2, b1, Oblique::Up, random, edge20.invert(), edge01.invert());
-    tileset({ 1, 5 }) = generateHorizontalSplit(db.settings.tile, b2, b0, b1, HSplit::Bottom, random, edge20, edge01, edge12);
-
-    tileset({ 2, 0 }) = generateOblique(db.settings.tile, b1, b2, b0, Oblique::Up, random, edge12, edge01);
-    tileset({ 2, 1 }) = generateOblique(db.settings.tile, b0, b1, b2, Oblique::Up, random, edge01, edge20);
-    tileset({ 2, 2 }) = generateVerticalSplit(db.settings.tile, b2, b0, b1, VSplit::Right, random, edge20, edge01, edge12);
-    tileset({ 2, 3 }) = generateVerticalSplit(db.settings.tile, b2, b1, b0, VSplit::Right, random, edge12.invert(), edge01.invert(), edge20.invert());
-    tileset({ 2, 4 }) = generateOblique(db.settings.tile, b0, b1, b2, Oblique::Down, random, edge01, edge20);
-    tileset({ 2, 5 }) = generateOblique(db.settings.tile, b1, b2, b0, Oblique::Down, random, edge12, edge01);
-
-    tileset({ 3, 0 }) = generateHorizontalSplit(db.settings.tile, b1, b0, b2, HSplit::Top, random, edge01.invert(), edge20.invert(), edge12.invert());
-    tileset({ 3, 1 }) = generateOblique(db.settings.tile, b2, b0, b1, Oblique::Up, random, edge20, edge12);
-    tileset({ 3, 2 }) = generateVerticalSplit(db.settings.tile, b2, b1, b0, VSplit::Left, random, edge12.invert(), edge01.invert(), edge20.invert());
-    tileset({ 3, 3 }) = generateVerticalSplit(db.settings.tile, b2, b0, b1, VSplit::Left, random, edge20, edge01, edge12);
-    tileset({ 3, 4 }) = generateOblique(db.settings.tile, b2, b0, b1, Oblique::Down, random, edge20, edge12);
-    tileset({ 3, 5 }) = generateHorizontalSplit(db.settings.tile, b1, b0, b2, HSplit::Bottom, random, edge01.invert(), edge20.invert(), edge12.invert());
-
-    tileset({ 4, 0 }) = generateVerticalSplit(db.settings.tile, b0, b1, b2, VSplit::Right, random, edge01, edge12, edge20);
-    tileset({ 4, 1 }) = generateOblique(db.settings.tile, b2, b1, b0, Oblique::Down, random, edge12.invert(), edge20.invert());
-    tileset({ 4, 2 }) = generateHorizontalSplit(db.settings.tile, b0, b1, b2, HSplit::Bottom, random, edge01, edge12, edge20);
-    tileset({ 4, 3 }) = generateHorizontalSplit(db.settings.tile, b0, b1, b2, HSplit::Top, random, edge01, edge12, edge20);
-    tileset({ 4, 4 }) = generateOblique(db.settings.tile, b2, b1, b0, Oblique::Up, random, edge12.invert(), edge20.invert());
-    tileset({ 4, 5 }) = generateVerticalSplit(db.settings.tile, b0, b2, b1, VSplit::Right, random, edge20.invert(), edge12.invert(), edge01.invert());
-
-    tileset({ 5, 0 }) = generateVerticalSplit(db.settings.tile, b0, b2, b1, VSplit::Left, random, edge20.invert(), edge12.invert(), edge01.invert());
-    tileset({ 5, 1 }) = generateVerticalSplit(db.settings.tile, b1, b0, b2, VSplit::Right, random, edge01.invert(), edge20.invert(), edge12.invert());
-    tileset({ 5, 2 }) = generateHorizontalSplit(db.settings.tile, b0, b2, b1, HSplit::Bottom, random, edge20.invert(), edge12.invert(), edge01.invert());
-    tileset({ 5, 3 }) = generateHorizontalSplit(db.settings.tile, b0, b2, b1, HSplit::Top, random, edge20.invert(), edge12.invert(), edge01.invert());
-    tileset({ 5, 4 }) = generateVerticalSplit(db.settings.tile, b1, b2, b0, VSplit::Right, random, edge12, edge20, edge01);
-    tileset({ 5, 5 }) = generateVerticalSplit(db.settings.tile, b0, b1, b2, VSplit::Left, random, edge01, edge12, edge20);
+    switch (position.x * Wang3TilesetSize + position.y) {
+      case 0 * Wang3TilesetSize + 0: return generateHorizontalSplit(db.settings.tile, b2, b1, b0, HSplit::Top, random, edge12.invert(), edge01.invert(), edge20.invert());
+      case 0 * Wang3TilesetSize + 1: return generateVerticalSplit(db.settings.tile, b1, b0, b2, VSplit::Left, random, edge01.invert(), edge20.invert(), edge12.invert());
+      case 0 * Wang3TilesetSize + 2: return generateOblique(db.settings.tile, b1, b0, b2, Oblique::Down, random, edge01.invert(), edge12.invert());
+      case 0 * Wang3TilesetSize + 3: return generateOblique(db.settings.tile, b1, b0, b2, Oblique::Up, random, edge01.invert(), edge12.invert());
+      case 0 * Wang3TilesetSize + 4: return generateVerticalSplit(db.settings.tile, b1, b2, b0, VSplit::Left, random, edge12, edge20, edge01);
+      case 0 * Wang3TilesetSize + 5: return generateHorizontalSplit(db.settings.tile, b2, b1, b0, HSplit::Bottom, random, edge12.invert(), edge01.invert(), edge20.invert());
+
+      case 1 * Wang3TilesetSize + 0: return generateHorizontalSplit(db.settings.tile, b2, b0, b1, HSplit::Top, random, edge20, edge01, edge12);
+      case 1 * Wang3TilesetSize + 1: return generateOblique(db.settings.tile, b0, b2, b1, Oblique::Down, random, edge20.invert(), edge01.invert());
+      case 1 * Wang3TilesetSize + 2: return generateHorizontalSplit(db.settings.tile, b1, b2, b0, HSplit::Bottom, random, edge12, edge20, edge01);
+      case 1 * Wang3TilesetSize + 3: return generateHorizontalSplit(db.settings.tile, b1, b2, b0, HSplit::Top, random, edge12, edge20, edge01);
+      case 1 * Wang3TilesetSize + 4: return generateOblique(db.settings.tile, b0, b2, b1, Oblique::Up, random, edge20.invert(), edge01.invert());
+      case 1 * Wang3TilesetSize + 5: return generateHorizontalSplit(db.settings.tile, b2, b0, b1, HSplit::Bottom, random, edge20, edge01, edge12);
+
+      case 2 * Wang3TilesetSize + 0: return generateOblique(db.settings.tile, b1, b2, b0, Oblique::Up, random, edge12, edge01);
+      case 2 * Wang3TilesetSize + 1: return generateOblique(db.settings.tile, b0, b1, b2, Oblique::Up, random, edge01, edge20);
+      case 2 * Wang3TilesetSize + 2: return generateVerticalSplit(db.settings.tile, b2, b0, b1, VSplit::Right, random, edge20, edge01, edge12);
+      case 2 * Wang3TilesetSize + 3: return generateVerticalSplit(db.settings.tile, b2, b1, b0, VSplit::Right, random, edge12.invert(), edge01.invert(), edge20.invert());
+      case 2 * Wang3TilesetSize + 4: return generateOblique(db.settings.tile, b0, b1, b2, Oblique::Down, random, edge01, edge20);
+      case 2 * Wang3TilesetSize + 5: return generateOblique(db.settings.tile, b1, b2, b0, Oblique::Down, random, edge12, edge01);
+
+      case 3 * Wang3TilesetSize + 0: return generateHorizontalSplit(db.settings.tile, b1, b0, b2, HSplit::Top, random, edge01.invert(), edge20.invert(), edge12.invert());
+      case 3 * Wang3TilesetSize + 1: return generateOblique(db.settings.tile, b2, b0, b1, Oblique::Up, random, edge20, edge12);
+      case 3 * Wang3TilesetSize + 2: return generateVerticalSplit(db.settings.tile, b2, b1, b0, VSplit::Left, random, edge12.invert(), edge01.invert(), edge20.invert());
+      case 3 * Wang3TilesetSize + 3: return generateVerticalSplit(db.settings.tile, b2, b0, b1, VSplit::Left, random, edge20, edge01, edge12);
+      case 3 * Wang3TilesetSize + 4: return generateOblique(db.settings.tile, b2, b0, b1, Oblique::Down, random, edge20, edge12);
+      case 3 * Wang3TilesetSize + 5: return generateHorizontalSplit(db.settings.tile, b1, b0, b2, HSplit::Bottom, random, edge01.invert(), edge20.invert(), edge12.invert());
+
+      case 4 * Wang3TilesetSize + 0: return generateVerticalSplit(db.settings.tile, b0, b1, b2, VSplit::Right, random, edge01, edge12, edge20);
+      case 4 * Wang3TilesetSize + 1: return generateOblique(db.settings.tile, b2, b1, b0, Oblique::Down, random, edge12.invert(), edge20.invert());
+      case 4 * Wang3TilesetSize + 2: return generateHorizontalSplit(db.settings.tile, b0, b1, b2, HSplit::Bottom, random, edge01, edge12, edge20);
+      case 4 * Wang3TilesetSize + 3: return generateHorizontalSplit(db.settings.tile, b0, b1, b2, HSplit::Top, random, edge01, edge12, edge20);
+      case 4 * Wang3TilesetSize + 4: return generateOblique(db.settings.tile, b2, b1, b0, Oblique::Up, random, edge12.invert(), edge20.invert());
+      case 4 * Wang3TilesetSize + 5: return generateVerticalSplit(db.settings.tile, b0, b2, b1, VSplit::Right, random, edge20.invert(), edge12.invert(), edge01.invert());
+
+      case 5 * Wang3TilesetSize + 0: return generateVerticalSplit(db.settings.tile, b0, b2, b1, VSplit::Left, random, edge20.invert(), edge12.invert(), edge01.invert());
+      case 5 * Wang3TilesetSize + 1: return generateVerticalSplit(db.settings.tile, b1, b0, b2, VSplit::Right, random, edge01.invert(), edge20.invert(), edge12.invert());
+      case 5 * Wang3TilesetSize + 2: return generateHorizontalSplit(db.settings.tile, b0, b2, b1, HSplit::Bottom, random, edge20.invert(), edge12.invert(), edge01.invert());
+      case 5 * Wang3TilesetSize + 3: return generateHorizontalSplit(db.settings.tile, b0, b2, b1, HSplit::Top, random, edge20.invert(), edge12.invert(), edge01.invert());
+      case 5 * Wang3TilesetSize + 4: return generateVerticalSplit(db.settings.tile, b1, b2, b0, VSplit::Right, random, edge12, edge20, edge01);
+      case 5 * Wang3TilesetSize + 5: return generateVerticalSplit(db.settings.tile, b0, b1, b2, VSplit::Left, random, edge01, edge12, edge20);
+    }
+
+    assert(false);
+    return generateFull(db.settings.tile, b0);
+  }
+
+  Tileset generateThreeCornersWangTileset(const Wang3& wang, const TileRandom& random, const TilesetData& db) {
+    Tileset tileset({ Wang3TilesetSize, Wang3TilesetSize });
+
+    for (auto position : tileset.tiles.getPositionRange()) {
+      gf::Random tileRandom = random(position);
+      tileset(position) = generateThreeCornersWangTile(wang, position, tileRandom, db);
+    }
 
     return tileset;
   }
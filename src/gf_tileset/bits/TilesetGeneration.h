@@ -21,29 +21,172 @@
 #ifndef TILESET_GENERATION_H
 #define TILESET_GENERATION_H
 
+#include <cstdint>
+#include <memory>
+#include <memory_resource>
+#include <utility>
+#include <vector>
+
 #include <gf/Array2D.h>
 #include <gf/GeometryTypes.h>
 #include <gf/Id.h>
 #include <gf/Image.h>
-#include <gf/Polyline.h>
 #include <gf/Random.h>
 #include <gf/Vector.h>
 
+#include "TilesetArena.h"
 #include "TilesetData.h"
 
 namespace gftools {
 
+  // the labels of the pixels of a tile, the memory comes from the current arena when the grid is created, a copy
+  // always comes from the heap as the arena of the copy could be released before it. The labels can only be
+  // changed by the grid so that the count of the unassigned pixels is always up to date.
+  class LabelGrid {
+  public:
+    static constexpr uint8_t Unassigned = 0;
+
+    // positions in row-major order
+    class PositionRange {
+    public:
+      class Iterator {
+      public:
+        Iterator(gf::Vector2i position, int width)
+        : m_position(position)
+        , m_width(width)
+        {
+        }
+
+        gf::Vector2i operator*() const { return m_position; }
+
+        Iterator& operator++() {
+          if (++m_position.x == m_width) {
+            m_position.x = 0;
+            ++m_position.y;
+          }
+
+          return *this;
+        }
+
+        bool operator!=(const Iterator& other) const { return m_position.x != other.m_position.x || m_position.y != other.m_position.y; }
+
+      private:
+        gf::Vector2i m_position;
+        int m_width;
+      };
+
+      PositionRange(gf::Vector2i size)
+      : m_size(size)
+      {
+      }
+
+      Iterator begin() const { return { gf::vec(0, m_size.width > 0 ? 0 : m_size.height), m_size.width }; }
+      Iterator end() const { return { gf::vec(0, m_size.height), m_size.width }; }
+
+    private:
+      gf::Vector2i m_size;
+    };
+
+    struct NeighborRange {
+      gf::Vector2i positions[8];
+      int count = 0;
+
+      const gf::Vector2i *begin() const { return positions; }
+      const gf::Vector2i *end() const { return positions + count; }
+    };
+
+    LabelGrid() = default;
+    LabelGrid(gf::Vector2i size, uint8_t value);
+    LabelGrid(const LabelGrid& other);
+    LabelGrid(LabelGrid&& other) noexcept;
+    ~LabelGrid();
+
+    LabelGrid& operator=(const LabelGrid& other);
+    LabelGrid& operator=(LabelGrid&& other) noexcept;
+
+    gf::Vector2i getSize() const { return m_size; }
+    bool isValid(gf::Vector2i pos) const { return 0 <= pos.x && pos.x < m_size.width && 0 <= pos.y && pos.y < m_size.height; }
+
+    uint8_t operator()(gf::Vector2i pos) const { return m_labels[pos.y * m_size.width + pos.x]; }
+    const uint8_t *getDataPtr() const { return m_labels; }
+
+    void set(gf::Vector2i pos, uint8_t label) {
+      uint8_t& current = m_labels[pos.y * m_size.width + pos.x];
+      m_unassignedCount += (label == Unassigned ? 1 : 0) - (current == Unassigned ? 1 : 0);
+      current = label;
+    }
+
+    // all the labels at once, e.g. from a file
+    void setLabels(const uint8_t *labels);
+
+    int getUnassignedCount() const { return m_unassignedCount; }
+
+    // the unassigned pixels connected to start (4-connectivity) get the label
+    void fillFrom(gf::Vector2i start, uint8_t label);
+    // each unassigned pixel gets the label of one of its neighbors (8-connectivity). It is a separate pass over the
+    // grid after the fills, that returns at once if the fills assigned every pixel and stops after the last hole
+    void fillHoles();
+
+    PositionRange getPositionRange() const { return PositionRange(m_size); }
+    NeighborRange get4NeighborsRange(gf::Vector2i pos) const;
+    NeighborRange get8NeighborsRange(gf::Vector2i pos) const;
+
+  private:
+    std::size_t getCount() const { return static_cast<std::size_t>(m_size.width) * m_size.height; }
+    void release();
+
+  private:
+    std::pmr::memory_resource *m_resource = nullptr;
+    uint8_t *m_labels = nullptr;
+    gf::Vector2i m_size = gf::vec(0, 0);
+    int m_unassignedCount = 0;
+  };
+
+  // the biomes of a tile, stored as an index in a small palette as a tile has at most three biomes (see Origin)
   struct Pixels {
-    gf::Array2D<gf::Id, int> data;
+    static constexpr uint8_t Unassigned = LabelGrid::Unassigned;
+    static constexpr uint8_t NoLabel = 0xFF;
+    static constexpr std::size_t PaletteSize = 4;
+
+    class Reference {
+    public:
+      Reference(Pixels& pixels, gf::Vector2i pos)
+      : m_pixels(pixels)
+      , m_pos(pos)
+      {
+      }
+
+      operator gf::Id() const { return m_pixels.palette[m_pixels.data(m_pos)]; }
+      Reference& operator=(gf::Id biome) {
+        m_pixels.data.set(m_pos, m_pixels.addLabel(biome));
+        return *this;
+      }
+
+    private:
+      Pixels& m_pixels;
+      gf::Vector2i m_pos;
+    };
+
+    LabelGrid data;
+    gf::Id palette[PaletteSize] = { gf::InvalidId, gf::InvalidId, gf::InvalidId, gf::InvalidId };
 
     Pixels() = default;
     Pixels(gf::Vector2i size, gf::Id biome);
 
-    gf::Id& operator()(gf::Vector2i pos) { return data(pos); }
-    gf::Id operator()(gf::Vector2i pos) const { return data(pos); }
+    Reference operator()(gf::Vector2i pos) { return { *this, pos }; }
+    gf::Id operator()(gf::Vector2i pos) const { return palette[data(pos)]; }
 
-    void fillFrom(gf::Vector2i start, gf::Id biome);
-    void checkHoles();
+    // NoLabel if the biome is not in the tile
+    uint8_t getLabel(gf::Id biome) const;
+    uint8_t addLabel(gf::Id biome);
+
+    void fillFrom(gf::Vector2i start, gf::Id biome) {
+      data.fillFrom(start, addLabel(biome));
+    }
+
+    void checkHoles() {
+      data.fillHoles();
+    }
   };
 
   struct Origin {
@@ -92,20 +235,53 @@ namespace gftools {
     Origin origin;
     Pixels pixels;
     Fences fences;
-    std::vector<gf::Polyline> limits;
     std::array<gf::Id, 4> terrain;
   };
 
   struct Tileset {
-    gf::Array2D<Tile, int> tiles;
+    std::shared_ptr<TileArena> arena; // the memory of the pixels of the tiles, if generated in a scope of the arena
+    gf::Array2D<Tile, int> tiles; // destroyed before the arena
     gf::Vector2i position;
 
     Tileset(gf::Vector2i size);
 
+    // the tiles are always released before the arena they come from, a copy has its pixels in the heap
+    Tileset(const Tileset& other);
+    Tileset(Tileset&& other) noexcept;
+    ~Tileset() = default;
+
+    Tileset& operator=(const Tileset& other);
+    Tileset& operator=(Tileset&& other) noexcept;
+
+    // only keep what is needed for the tsx: origin, terrain and fences, the arena is released
+    void clearPixels();
+
     Tile& operator()(gf::Vector2i pos) { return tiles(pos); }
     const Tile& operator()(gf::Vector2i pos) const { return tiles(pos); }
   };
 
+  // counter-based random: the generator of a tile only depends on the key, on the position of the tile and on its
+  // salt if it was rolled again, so that a tile can be generated again without the tiles before it
+  class TileRandom {
+  public:
+    explicit TileRandom(uint64_t key, std::vector<TileSalt> salts = {})
+    : m_key(key)
+    , m_salts(std::move(salts))
+    {
+    }
+
+    gf::Random operator()(gf::Vector2i position) const;
+
+    bool hasSalt(gf::Vector2i position) const;
+
+    // see https://prng.di.unimi.it/splitmix64.c
+    static uint64_t mix(uint64_t x);
+
+  private:
+    uint64_t m_key;
+    std::vector<TileSalt> m_salts;
+  };
+
   Tile generateFull(const TileSettings& settings, gf::Id b0);
 
   enum class Split {
@@ -155,8 +331,24 @@ namespace gftools {
 
 
   Tileset generatePlainTileset(gf::Id b0, const TilesetData& db);
-  Tileset generateTwoCornersWangTileset(const Wang2& wang, gf::Random& random, const TilesetData& db);
-  Tileset generateThreeCornersWangTileset(const Wang3& wang, gf::Random& random, const TilesetData& db);
+
+  // the tile at the position in the tileset
+  Tile generateTwoCornersWangTile(const Wang2& wang, gf::Vector2i position, gf::Random& random, const TilesetData& db);
+  Tileset generateTwoCornersWangTileset(const Wang2& wang, const TileRandom& random, const TilesetData& db);
+
+  // the tiles of the tileset that are exactly a flip of a canonical tile (the two full tiles, the two corners, the
+  // split and the cross): without the random displacement of the edge, the flipped canonical tile has the same
+  // pixels as the tile. One bit per tile, at x * Wang2TilesetSize + y, the canonical tiles are not set. It only
+  // depends on the tile size and on the offset of the edge.
+  uint16_t computeTwoCornersWangSymmetries(const Wang2& wang, const TilesetData& db);
+
+  // the canonical tiles and the tiles that are not an exact flip of them, in a single row, see
+  // computeTwoCornersWangSymmetries. They are identical to the same tiles in the full tileset.
+  Tileset generateCanonicalTwoCornersWangTileset(const Wang2& wang, const TileRandom& random, const TilesetData& db);
+
+  // the tile at the position in the tileset
+  Tile generateThreeCornersWangTile(const Wang3& wang, gf::Vector2i position, gf::Random& random, const TilesetData& db);
+  Tileset generateThreeCornersWangTileset(const Wang3& wang, const TileRandom& random, const TilesetData& db);
 
 
 }
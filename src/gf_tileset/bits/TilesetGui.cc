@@ -22,7 +22,6 @@
 
 #include <cassert>
 #include <algorithm>
-#include <fstream>
 
 #include <imgui.h>
 
@@ -31,6 +30,8 @@
 #include <gf/RenderTarget.h>
 
 #include "TilesetData.h"
+#include "TilesetExport.h"
+#include "TilesetLayout.h"
 #include "TilesetProcess.h"
 
 namespace gftools {
@@ -42,10 +43,12 @@ namespace gftools {
 
     constexpr const char *PigmentStyleList[] = { "Plain", "Randomize", "Striped", "Paved" }; // see PigmentStyle
     constexpr const char *BorderEffectList[] = { "None", "Fade", "Outline", "Sharpen", "Lighten", "Blur", "Blend" }; // see BorderEffect
+    constexpr const char *DistanceMetricList[] = { "Manhattan", "Euclidean" }; // see DistanceMetric
+    constexpr const char *AtlasPackingList[] = { "Reserved", "Compact" }; // see AtlasPacking
 
 
     bool AtomCombo(const TilesetData& data, const char *label, gf::Id *current, std::initializer_list<gf::Id> forbidden) {
-      auto currentAtom = data.getAtom(*current);
+      auto& currentAtom = data.getAtom(*current);
 
       bool res = ImGui::BeginCombo(label, currentAtom.id.name.c_str());
 
@@ -81,14 +84,29 @@ namespace gftools {
   TilesetGui::TilesetGui(gf::Path datafile, TilesetData& data, gf::Random& random)
   : m_datafile(std::move(datafile))
   , m_data(data)
-  , m_random(random)
-  , m_size(m_data.settings.getImageSize())
+  , m_previews(random)
   {
   }
 
   void TilesetGui::render(gf::RenderTarget& target, [[maybe_unused]] const gf::RenderStates& states) {
     auto size = target.getSize();
 
+    // only the latest previews are uploaded
+
+    gf::Image preview;
+
+    if (m_previews.takePreview(PreviewKind::Atom, preview)) {
+      m_pigmentPreview = gf::Texture(preview);
+    }
+
+    if (m_previews.takePreview(PreviewKind::Wang2, preview)) {
+      m_wang2Preview = gf::Texture(preview);
+    }
+
+    if (m_previews.takePreview(PreviewKind::Wang3, preview)) {
+      m_wang3Preview = gf::Texture(preview);
+    }
+
     ImGui::SetNextWindowPos(ImVec2(0, 0));
     ImGui::SetNextWindowSize(ImVec2(size.width, size.height));
 
@@ -107,12 +125,21 @@ namespace gftools {
           static constexpr int InputFastStep = 64;
 
           if (ImGui::InputInt("TileSize", &m_data.settings.tile.size, InputSlowStep, InputFastStep)) {
-            m_size = m_data.settings.getImageSize();
             m_modified = true;
           }
 
           if (ImGui::InputInt("TileSpacing", &m_data.settings.tile.spacing, 1, 2)) {
-            m_size = m_data.settings.getImageSize();
+            m_modified = true;
+          }
+
+          if (ImGui::InputScalar("Seed", ImGuiDataType_U32, &m_data.settings.seed)) {
+            m_modified = true;
+          }
+
+          int metricChoice = static_cast<int>(m_data.settings.metric);
+
+          if (ImGui::Combo("Border Metric##DistanceMetric", &metricChoice, DistanceMetricList, IM_ARRAYSIZE(DistanceMetricList))) {
+            m_data.settings.metric = static_cast<DistanceMetric>(metricChoice);
             m_modified = true;
           }
 
@@ -120,22 +147,31 @@ namespace gftools {
             ImGui::Separator();
 
             if (ImGui::InputInt("Max Atom Count", &m_data.settings.maxAtomCount, InputSlowStep, InputFastStep)) {
-              m_size = m_data.settings.getImageSize();
               m_modified = true;
             }
 
             if (ImGui::InputInt("Max Wang2 Count", &m_data.settings.maxWang2Count, InputSlowStep, InputFastStep)) {
-              m_size = m_data.settings.getImageSize();
               m_modified = true;
             }
 
             if (ImGui::InputInt("Max Wang3 Count", &m_data.settings.maxWang3Count, InputSlowStep, InputFastStep)) {
-              m_size = m_data.settings.getImageSize();
+              m_modified = true;
+            }
+
+            int packingChoice = static_cast<int>(m_data.settings.packing);
+
+            if (ImGui::Combo("Atlas Packing##AtlasPacking", &packingChoice, AtlasPackingList, IM_ARRAYSIZE(AtlasPackingList))) {
+              m_data.settings.packing = static_cast<AtlasPacking>(packingChoice);
+              m_modified = true;
+            }
+
+            if (ImGui::Checkbox("Power of two size", &m_data.settings.powerOfTwo)) {
               m_modified = true;
             }
           }
 
-          ImGui::Text("Image size: %ix%i", m_size.width, m_size.height);
+          auto imageSize = getImageSize();
+          ImGui::Text("Image size: %ix%i", imageSize.width, imageSize.height);
 
           ImGui::EndTabItem();
         }
@@ -169,6 +205,7 @@ namespace gftools {
                 if (!m_data.settings.locked && index + 1 < m_data.atoms.size()) {
                   if (ImGui::ArrowButton("Down", ImGuiDir_Down)) {
                     std::swap(m_data.atoms[index], m_data.atoms[index + 1]);
+                    m_data.rebuildIndex();
                     m_modified = true;
                   }
                 } else {
@@ -180,6 +217,7 @@ namespace gftools {
                 if (!m_data.settings.locked && index > 0) {
                   if (ImGui::ArrowButton("Up", ImGuiDir_Up)) {
                     std::swap(m_data.atoms[index], m_data.atoms[index - 1]);
+                    m_data.rebuildIndex();
                     m_modified = true;
                   }
                 } else {
@@ -197,9 +235,7 @@ namespace gftools {
                 };
 
                 auto generatePreview = [this]() {
-                  m_data.temporary.atom = m_editedAtom;
-                  m_pigmentPreview = gf::Texture(generateAtomPreview(m_editedAtom, m_random, m_data.settings.tile));
-                  m_data.temporary.atom = Atom();
+                  m_previews.requestAtomPreview(m_editedAtom, m_data);
                 };
 
                 if (ImGui::Button("Edit")) {
@@ -328,6 +364,7 @@ namespace gftools {
 
                   if (ImGui::Button("Yes, I want to delete")) {
                     m_data.atoms.erase(m_data.atoms.begin() + index);
+                    m_data.rebuildIndex();
                     ImGui::CloseCurrentPopup();
                     m_modified = true;
                   }
@@ -356,6 +393,7 @@ namespace gftools {
             atom.color = gf::Color::White;
             atom.pigment.style = PigmentStyle::Plain;
             m_data.atoms.emplace_back(std::move(atom));
+            m_data.rebuildIndex();
             m_newAtom = true;
             m_modified = true;
           }
@@ -391,7 +429,7 @@ namespace gftools {
                     ImGui::Text("-");
                     ImGui::TableNextColumn();
                   } else {
-                    auto atom = m_data.getAtom(border.id.hash);
+                    auto& atom = m_data.getAtom(border.id.hash);
                     ImGui::ColorButton("##Color", ImVec4(atom.color.r, atom.color.g, atom.color.b, atom.color.a));
                     ImGui::SameLine();
                     ImGui::Text("%s", atom.id.name.c_str());
@@ -402,6 +440,7 @@ namespace gftools {
                 if (!m_data.settings.locked && index + 1 < m_data.wang2.size()) {
                   if (ImGui::ArrowButton("Down", ImGuiDir_Down)) {
                     std::swap(m_data.wang2[index], m_data.wang2[index + 1]);
+                    m_data.rebuildIndex();
                     m_modified = true;
                   }
                 } else {
@@ -413,6 +452,7 @@ namespace gftools {
                 if (!m_data.settings.locked && index > 0) {
                   if (ImGui::ArrowButton("Up", ImGuiDir_Up)) {
                     std::swap(m_data.wang2[index], m_data.wang2[index - 1]);
+                    m_data.rebuildIndex();
                     m_modified = true;
                   }
                 } else {
@@ -428,10 +468,7 @@ namespace gftools {
                 };
 
                 auto generatePreview = [this]() {
-                  m_data.temporary.wang2 = m_editedWang2;
-                  m_wang2Preview = gf::Texture(generateWang2Preview(m_editedWang2, m_random, m_data));
-//                   m_wang2Preview.setSmooth();
-                  m_data.temporary.wang2 = Wang2();
+                  m_previews.requestWang2Preview(m_editedWang2, m_data);
                 };
 
                 if (ImGui::Button("Edit")) {
@@ -476,8 +513,7 @@ namespace gftools {
                     if (border.id.hash != Void) {
                       if (AtomCombo(m_data, "##Wang2Atom", &border.id.hash, { m_editedWang2.borders[1 - j].id.hash })) {
                         changed = true;
-                        auto atom = m_data.getAtom(border.id.hash);
-                        border.id = atom.id;
+                        border.id = m_data.getAtom(border.id.hash).id;
                       }
 
                       if (ImGui::Combo("Border##BorderEffect", &m_borderEffectChoices[j], BorderEffectList, IM_ARRAYSIZE(BorderEffectList))) {
@@ -572,7 +608,22 @@ namespace gftools {
                   ImGui::Spacing();
 
                   if (ImGui::Button("Save")) {
+                    gf::Id id0 = wang.borders[0].id.hash;
+                    gf::Id id1 = wang.borders[1].id.hash;
+                    bool samePair = AtomPair(id0, id1) == AtomPair(m_editedWang2.borders[0].id.hash, m_editedWang2.borders[1].id.hash);
+
+                    if (!samePair) {
+                      m_data.removeWang3For(id0, id1);
+                    }
+
                     wang = m_editedWang2;
+                    m_data.rebuildIndex();
+
+                    if (!samePair) {
+                      m_data.addWang3For(id0, id1); // in case another wang2 has the same atoms
+                      m_data.addWang3For(wang.borders[0].id.hash, wang.borders[1].id.hash);
+                    }
+
                     ImGui::CloseCurrentPopup();
                     m_modified = true;
                   }
@@ -612,7 +663,12 @@ namespace gftools {
                   ImGui::SameLine();
 
                   if (ImGui::Button("Yes, I want to delete")) {
+                    gf::Id id0 = wang.borders[0].id.hash;
+                    gf::Id id1 = wang.borders[1].id.hash;
+                    m_data.removeWang3For(id0, id1);
                     m_data.wang2.erase(m_data.wang2.begin() + index);
+                    m_data.rebuildIndex();
+                    m_data.addWang3For(id0, id1); // in case another wang2 has the same atoms
                     ImGui::CloseCurrentPopup();
                     m_modified = true;
                   }
@@ -639,6 +695,8 @@ namespace gftools {
             wang.borders[1].id = m_data.atoms[1].id;
             wang.borders[1].effect = BorderEffect::None;
             m_data.wang2.emplace_back(std::move(wang));
+            m_data.rebuildIndex();
+            m_data.addWang3For(m_data.atoms[0].id.hash, m_data.atoms[1].id.hash);
             m_newWang2 = true;
             m_modified = true;
           }
@@ -674,7 +732,7 @@ namespace gftools {
                     ImGui::Text("-");
                     ImGui::TableNextColumn();
                   } else {
-                    auto atom = m_data.getAtom(id.hash);
+                    auto& atom = m_data.getAtom(id.hash);
                     ImGui::ColorButton("##Color", ImVec4(atom.color.r, atom.color.g, atom.color.b, atom.color.a));
                     ImGui::SameLine();
                     ImGui::Text("%s", atom.id.name.c_str());
@@ -709,8 +767,7 @@ namespace gftools {
                 };
 
                 auto generatePreview = [this]() {
-                  m_wang3Preview = gf::Texture(generateWang3Preview(m_editedWang3, m_random, m_data));
-//                   m_wang3Preview.setSmooth();
+                  m_previews.requestWang3Preview(m_editedWang3, m_data);
                 };
 
                 if (ImGui::Button("Edit")) {
@@ -752,8 +809,7 @@ namespace gftools {
                     if (id.hash != Void) {
                       if (AtomCombo(m_data, "##Wang3Atom", &id.hash, { m_editedWang3.ids[(j + 1) % 3].hash, m_editedWang3.ids[(j + 2) % 3].hash })) {
                         changed = true;
-                        auto atom = m_data.getAtom(id.hash);
-                        id = atom.id;
+                        id = m_data.getAtom(id.hash).id;
                       }
                     }
 
@@ -779,6 +835,7 @@ namespace gftools {
                   if (ImGui::Button("Save")) {
                     // TODO: add missing wang2
                     wang = m_editedWang3;
+                    m_data.rebuildWang3Index();
                     ImGui::CloseCurrentPopup();
                     m_modified = true;
                   }
@@ -819,6 +876,7 @@ namespace gftools {
 
                   if (ImGui::Button("Yes, I want to delete")) {
                     m_data.wang3.erase(m_data.wang3.begin() + index);
+                    m_data.rebuildWang3Index();
                     ImGui::CloseCurrentPopup();
                     m_modified = true;
                   }
@@ -844,6 +902,7 @@ namespace gftools {
             wang.ids[1] = m_data.atoms[1].id;
             wang.ids[2] = m_data.atoms[2].id;
             m_data.wang3.emplace_back(std::move(wang));
+            m_data.rebuildWang3Index();
             m_newWang3 = true;
             m_modified = true;
           }
@@ -879,19 +938,54 @@ namespace gftools {
       ImGui::SameLine();
 
       if (ImGui::Button("Export the tileset to TMX")) {
-        auto tilesets = generateTilesets(m_random, m_data);
-        auto image = generateTilesetImage(m_random, m_data, tilesets);
-        auto imagePath = m_datafile.replace_extension(".png");
-        image.saveToFile(imagePath);
-        auto xml = generateTilesetXml(imagePath.filename(), m_data, tilesets);
-        auto xmlPath = m_datafile.replace_extension(".tsx");
-        std::ofstream(xmlPath.string()) << xml;
+        ExportOptions options;
+        options.cache = getCacheDirectory(m_datafile);
+        options.deduplicate = m_deduplicate;
+        options.symmetric = m_symmetric;
+        options.compression = m_compression;
+        ExportStats stats;
+
+        if (exportTileset(m_data, m_datafile, options, stats)) {
+          logExportStats(stats);
+        }
       }
 
+      ImGui::SameLine();
+      ImGui::Checkbox("Deduplicate the tiles", &m_deduplicate);
+      ImGui::SameLine();
+      ImGui::Checkbox("Only the canonical tiles", &m_symmetric);
+      ImGui::SameLine();
+      ImGui::SliderInt("Compression", &m_compression, 0, 9);
+
     }
 
     ImGui::End();
   }
 
+  gf::Vector2i TilesetGui::getImageSize() {
+    // the layout only depends on the settings and on the number of tilesets, and the compact packing tries many
+    // widths so it is not computed at each frame
+    const Settings& settings = m_data.settings;
+
+    std::array<int, 10> key = {
+      settings.tile.size,
+      settings.tile.spacing,
+      settings.maxAtomCount,
+      settings.maxWang2Count,
+      settings.maxWang3Count,
+      static_cast<int>(settings.packing),
+      settings.powerOfTwo ? 1 : 0,
+      static_cast<int>(m_data.atoms.size()),
+      static_cast<int>(m_data.wang2.size()),
+      static_cast<int>(m_data.wang3.size())
+    };
+
+    if (m_imageSize.width < 0 || key != m_imageSizeKey) {
+      m_imageSize = computeAtlasLayout(m_data).size;
+      m_imageSizeKey = key;
+    }
+
+    return m_imageSize;
+  }
 
 }
@@ -21,11 +21,14 @@
 #ifndef TILESET_GUI_H
 #define TILESET_GUI_H
 
+#include <array>
+
 #include <gf/Entity.h>
 #include <gf/Random.h>
 #include <gf/Texture.h>
 
 #include "TilesetData.h"
+#include "TilesetPreview.h"
 
 namespace gftools {
 
@@ -35,15 +38,24 @@ namespace gftools {
 
     void render(gf::RenderTarget& target, const gf::RenderStates& states) override;
 
+  private:
+    gf::Vector2i getImageSize();
+
   private:
     gf::Path m_datafile;
     TilesetData& m_data;
-    gf::Random& m_random;
 
     bool m_modified = false;
+    bool m_deduplicate = false;
+    bool m_symmetric = false;
+    int m_compression = 6;
+
+    // the size of the atlas, computed again only when what it depends on changes, see getImageSize
+    std::array<int, 10> m_imageSizeKey;
+    gf::Vector2i m_imageSize = gf::vec(-1, -1);
 
-    // for settings
-    gf::Vector2i m_size;
+    // previews of the edited elements
+    PreviewWorker m_previews;
 
     // edit for atoms
     Atom m_editedAtom;
@@ -0,0 +1,240 @@
+/*
+ * gf-tools
+ * Copyright (C) 2020 Julien Bernard
+ *
+ * This software is provided 'as-is', without any express or implied
+ * warranty.  In no event will the authors be held liable for any damages
+ * arising from the use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ *    claim that you wrote the original software. If you use this software
+ *    in a product, an acknowledgment in the product documentation would be
+ *    appreciated but is not required.
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ *    misrepresented as being the original software.
+ * 3. This notice may not be removed or altered from any source distribution.
+ */
+#include "TilesetKernels.h"
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define TILESET_KERNELS_AVX2
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define TILESET_KERNELS_SSE2
+#endif
+
+#include <algorithm>
+
+namespace gftools {
+
+  namespace {
+
+    void convertToRgba32Scalar(const gf::Color4f *colors, std::size_t count, uint8_t *pixels) {
+      for (std::size_t i = 0; i < count; ++i) {
+        gf::Color4u color = gf::Color::toRgba32(colors[i]);
+        pixels[4 * i + 0] = color.r;
+        pixels[4 * i + 1] = color.g;
+        pixels[4 * i + 2] = color.b;
+        pixels[4 * i + 3] = color.a;
+      }
+    }
+
+#if defined(TILESET_KERNELS_AVX2)
+
+    // 8 colors at a time
+    std::size_t convertToRgba32Vector(const gf::Color4f *colors, std::size_t count, uint8_t *pixels) {
+      const float *input = reinterpret_cast<const float *>(colors);
+      const __m256 zero = _mm256_setzero_ps();
+      const __m256 one = _mm256_set1_ps(1.0f);
+      const __m256 scale = _mm256_set1_ps(255.0f);
+      // packs work in each 128-bit lane, this puts the colors back in order
+      const __m256i order = _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7);
+
+      auto convert = [&](const float *data) {
+        __m256 value = _mm256_loadu_ps(data);
+        value = _mm256_min_ps(_mm256_max_ps(value, zero), one);
+        return _mm256_cvttps_epi32(_mm256_mul_ps(value, scale));
+      };
+
+      std::size_t i = 0;
+
+      for (; i + 8 <= count; i += 8) {
+        const float *data = input + 4 * i;
+        __m256i c01 = convert(data);
+        __m256i c23 = convert(data + 8);
+        __m256i c45 = convert(data + 16);
+        __m256i c67 = convert(data + 24);
+
+        __m256i c0213 = _mm256_packs_epi32(c01, c23);
+        __m256i c4657 = _mm256_packs_epi32(c45, c67);
+        __m256i bytes = _mm256_packus_epi16(c0213, c4657);
+        bytes = _mm256_permutevar8x32_epi32(bytes, order);
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(pixels + 4 * i), bytes);
+      }
+
+      return i;
+    }
+
+#elif defined(TILESET_KERNELS_SSE2)
+
+    // 4 colors at a time
+    std::size_t convertToRgba32Vector(const gf::Color4f *colors, std::size_t count, uint8_t *pixels) {
+      const float *input = reinterpret_cast<const float *>(colors);
+      const __m128 zero = _mm_setzero_ps();
+      const __m128 one = _mm_set1_ps(1.0f);
+      const __m128 scale = _mm_set1_ps(255.0f);
+
+      auto convert = [&](const float *data) {
+        __m128 value = _mm_loadu_ps(data);
+        value = _mm_min_ps(_mm_max_ps(value, zero), one);
+        return _mm_cvttps_epi32(_mm_mul_ps(value, scale));
+      };
+
+      std::size_t i = 0;
+
+      for (; i + 4 <= count; i += 4) {
+        const float *data = input + 4 * i;
+        __m128i c01 = _mm_packs_epi32(convert(data), convert(data + 4));
+        __m128i c23 = _mm_packs_epi32(convert(data + 8), convert(data + 12));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(pixels + 4 * i), _mm_packus_epi16(c01, c23));
+      }
+
+      return i;
+    }
+
+#else
+
+    std::size_t convertToRgba32Vector([[maybe_unused]] const gf::Color4f *colors, [[maybe_unused]] std::size_t count, [[maybe_unused]] uint8_t *pixels) {
+      return 0;
+    }
+
+#endif
+
+    /*
+     * one color in a register when possible
+     */
+
+#if defined(TILESET_KERNELS_AVX2) || defined(TILESET_KERNELS_SSE2)
+
+    using Pixel = __m128;
+
+    Pixel loadPixel(const gf::Color4f *color) {
+      return _mm_loadu_ps(reinterpret_cast<const float *>(color));
+    }
+
+    void storePixel(gf::Color4f *color, Pixel pixel) {
+      _mm_storeu_ps(reinterpret_cast<float *>(color), pixel);
+    }
+
+    Pixel zeroPixel() {
+      return _mm_setzero_ps();
+    }
+
+    Pixel multiplyAdd(Pixel sum, Pixel pixel, float weight) {
+      return _mm_add_ps(sum, _mm_mul_ps(pixel, _mm_set1_ps(weight)));
+    }
+
+    Pixel scalePixel(Pixel pixel, float factor) {
+      return _mm_mul_ps(pixel, _mm_set1_ps(factor));
+    }
+
+#else
+
+    using Pixel = gf::Color4f;
+
+    Pixel loadPixel(const gf::Color4f *color) {
+      return *color;
+    }
+
+    void storePixel(gf::Color4f *color, Pixel pixel) {
+      *color = pixel;
+    }
+
+    Pixel zeroPixel() {
+      return gf::Color4f(0.0f, 0.0f, 0.0f, 0.0f);
+    }
+
+    Pixel multiplyAdd(Pixel sum, Pixel pixel, float weight) {
+      return sum + pixel * weight;
+    }
+
+    Pixel scalePixel(Pixel pixel, float factor) {
+      return pixel * factor;
+    }
+
+#endif
+
+    constexpr int BlurRadius = 2;
+    constexpr float BlurWeights[2 * BlurRadius + 1] = { 1.0f, 4.0f, 6.0f, 4.0f, 1.0f };
+    constexpr float BlurWeightSum = 16.0f;
+
+    // the inverse of the sum of the weights inside [0, count)
+    float computeBlurNormalization(int i, int count) {
+      if (i >= BlurRadius && i + BlurRadius < count) {
+        return 1.0f / BlurWeightSum;
+      }
+
+      float sum = 0.0f;
+
+      for (int k = -BlurRadius; k <= BlurRadius; ++k) {
+        if (i + k >= 0 && i + k < count) {
+          sum += BlurWeights[k + BlurRadius];
+        }
+      }
+
+      return 1.0f / sum;
+    }
+
+  }
+
+  void convertToRgba32(const gf::Color4f *colors, std::size_t count, uint8_t *pixels) {
+    std::size_t done = convertToRgba32Vector(colors, count, pixels);
+    convertToRgba32Scalar(colors + done, count - done, pixels + 4 * done);
+  }
+
+  void blurBinomial5(const gf::Color4f *source, gf::Color4f *target, gf::Color4f *buffer, gf::Vector2i size) {
+    // horizontal pass: source to buffer
+
+    for (int y = 0; y < size.height; ++y) {
+      const gf::Color4f *row = source + y * size.width;
+      gf::Color4f *output = buffer + y * size.width;
+
+      for (int x = 0; x < size.width; ++x) {
+        int first = std::max(x - BlurRadius, 0);
+        int last = std::min(x + BlurRadius, size.width - 1);
+        Pixel sum = zeroPixel();
+
+        for (int i = first; i <= last; ++i) {
+          sum = multiplyAdd(sum, loadPixel(row + i), BlurWeights[i - x + BlurRadius]);
+        }
+
+        storePixel(output + x, scalePixel(sum, computeBlurNormalization(x, size.width)));
+      }
+    }
+
+    // vertical pass: buffer to target, whole rows at a time
+
+    for (int y = 0; y < size.height; ++y) {
+      int first = std::max(y - BlurRadius, 0);
+      int last = std::min(y + BlurRadius, size.height - 1);
+      float normalization = computeBlurNormalization(y, size.height);
+      gf::Color4f *output = target + y * size.width;
+
+      for (int x = 0; x < size.width; ++x) {
+        Pixel sum = zeroPixel();
+
+        for (int i = first; i <= last; ++i) {
+          sum = multiplyAdd(sum, loadPixel(buffer + i * size.width + x), BlurWeights[i - y + BlurRadius]);
+        }
+
+        storePixel(output + x, scalePixel(sum, normalization));
+      }
+    }
+  }
+
+}
@@ -0,0 +1,41 @@
+/*
+ * gf-tools
+ * Copyright (C) 2020 Julien Bernard
+ *
+ * This software is provided 'as-is', without any express or implied
+ * warranty.  In no event will the authors be held liable for any damages
+ * arising from the use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ *    claim that you wrote the original software. If you use this software
+ *    in a product, an acknowledgment in the product documentation would be
+ *    appreciated but is not required.
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ *    misrepresented as being the original software.
+ * 3. This notice may not be removed or altered from any source distribution.
+ */
+#ifndef TILESET_KERNELS_H
+#define TILESET_KERNELS_H
+
+#include <cstddef>
+#include <cstdint>
+
+#include <gf/Color.h>
+#include <gf/Vector.h>
+
+namespace gftools {
+
+  // same as gf::Color::toRgba32 on each color: clamped to [0, 1], scaled to [0, 255] and truncated
+  void convertToRgba32(const gf::Color4f *colors, std::size_t count, uint8_t *pixels);
+
+  // separable 5x5 binomial blur ([1 4 6 4 1] on each axis), near the edges the weights of the pixels
+  // inside the image are renormalized, the buffer is used for the intermediate pass, all have size pixels
+  void blurBinomial5(const gf::Color4f *source, gf::Color4f *target, gf::Color4f *buffer, gf::Vector2i size);
+
+}
+
+#endif // TILESET_KERNELS_H
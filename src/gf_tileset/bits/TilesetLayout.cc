@@ -0,0 +1,225 @@
+/*
+ * gf-tools
+ * Copyright (C) 2020 Julien Bernard
+ *
+ * This software is provided 'as-is', without any express or implied
+ * warranty.  In no event will the authors be held liable for any damages
+ * arising from the use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ *    claim that you wrote the original software. If you use this software
+ *    in a product, an acknowledgment in the product documentation would be
+ *    appreciated but is not required.
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ *    misrepresented as being the original software.
+ * 3. This notice may not be removed or altered from any source distribution.
+ */
+#include "TilesetLayout.h"
+
+#include <cstdint>
+#include <algorithm>
+
+#include <gf/Log.h>
+#include <gf/VectorOps.h>
+
+namespace gftools {
+
+  namespace {
+
+    constexpr int MaxAtlasSize = 8192;
+
+    int computeLineCount(int count, int perLine) {
+      return count / perLine + ((count % perLine == 0) ? 0 : 1);
+    }
+
+    int roundToPowerOfTwo(int value) {
+      int result = 1;
+
+      while (result < value) {
+        result *= 2;
+      }
+
+      return result;
+    }
+
+    gf::Vector2i layoutLine(std::size_t index, int perLine) {
+      int i = static_cast<int>(index);
+      return perLine > 0 ? gf::vec(i % perLine, i / perLine) : gf::vec(i, 0);
+    }
+
+    // room for the max counts of the settings, the tiles do not move when the project grows
+    AtlasLayout computeReservedLayout(const TilesetData& db) {
+      const Settings& settings = db.settings;
+      int size = settings.tile.getExtendedSize();
+      int step = size * 12;
+
+      int atomsPerLine = 0;
+      int atomsLineCount = 0;
+      int wang2PerLine = 0;
+      int wang2LineCount = 0;
+      int wang3PerLine = 0;
+      AtlasLayout layout;
+
+      for (int width = step; width <= MaxAtlasSize; width += step) {
+        int height = 0;
+
+        atomsPerLine = width / (AtomsTilesetSize * size);
+
+        if (atomsPerLine == 0) {
+          continue;
+        }
+
+        atomsLineCount = computeLineCount(settings.maxAtomCount, atomsPerLine);
+        height += atomsLineCount * (AtomsTilesetSize * size);
+
+        if (height > width) {
+          continue;
+        }
+
+        wang2PerLine = width / (Wang2TilesetSize * size);
+
+        if (wang2PerLine == 0) {
+          continue;
+        }
+
+        wang2LineCount = computeLineCount(settings.maxWang2Count, wang2PerLine);
+        height += wang2LineCount * (Wang2TilesetSize * size);
+
+        if (height > width) {
+          continue;
+        }
+
+        wang3PerLine = width / (Wang3TilesetSize * size);
+
+        if (wang3PerLine == 0) {
+          continue;
+        }
+
+        int wang3LineCount = computeLineCount(settings.maxWang3Count, wang3PerLine);
+        height += wang3LineCount * (Wang3TilesetSize * size);
+
+        if (height > width) {
+          continue;
+        }
+
+        layout.size = gf::vec(width, height);
+        break;
+      }
+
+      if (layout.size.width == 0) {
+        gf::Log::error("Could not reserve an atlas for %i atoms, %i wang2 and %i wang3\n", settings.maxAtomCount, settings.maxWang2Count, settings.maxWang3Count);
+        atomsPerLine = atomsLineCount = wang2PerLine = wang2LineCount = wang3PerLine = 0;
+      }
+
+      gf::Vector2i atomsPosition(0, 0);
+      gf::Vector2i wang2Position = atomsPosition + gf::vec(0, atomsLineCount * AtomsTilesetSize);
+      gf::Vector2i wang3Position = wang2Position + gf::vec(0, wang2LineCount * Wang2TilesetSize);
+
+      for (std::size_t i = 0; i < db.atoms.size(); ++i) {
+        layout.positions.push_back(atomsPosition + layoutLine(i, atomsPerLine) * AtomsTilesetSize);
+      }
+
+      for (std::size_t i = 0; i < db.wang2.size(); ++i) {
+        layout.positions.push_back(wang2Position + layoutLine(i, wang2PerLine) * Wang2TilesetSize);
+      }
+
+      for (std::size_t i = 0; i < db.wang3.size(); ++i) {
+        layout.positions.push_back(wang3Position + layoutLine(i, wang3PerLine) * Wang3TilesetSize);
+      }
+
+      return layout;
+    }
+
+    // next fit shelves in the order of the tilesets, so that the lines of the atlas follow the indices
+    int packShelves(const std::vector<int>& sizes, int width, std::vector<gf::Vector2i> *positions) {
+      int x = 0;
+      int y = 0;
+      int shelfHeight = 0;
+
+      for (std::size_t i = 0; i < sizes.size(); ++i) {
+        if (x + sizes[i] > width) {
+          x = 0;
+          y += shelfHeight;
+          shelfHeight = 0;
+        }
+
+        if (positions != nullptr) {
+          (*positions)[i] = gf::vec(x, y);
+        }
+
+        x += sizes[i];
+        shelfHeight = std::max(shelfHeight, sizes[i]);
+      }
+
+      return y + shelfHeight;
+    }
+
+    // only the actual tilesets, the width is chosen for the image to be as small as possible
+    AtlasLayout computeCompactLayout(const TilesetData& db) {
+      int size = db.settings.tile.getExtendedSize();
+
+      std::vector<int> sizes;
+      sizes.insert(sizes.end(), db.atoms.size(), AtomsTilesetSize);
+      sizes.insert(sizes.end(), db.wang2.size(), Wang2TilesetSize);
+      sizes.insert(sizes.end(), db.wang3.size(), Wang3TilesetSize);
+
+      int minWidth = std::max({ AtomsTilesetSize, Wang2TilesetSize, Wang3TilesetSize });
+      int maxWidth = std::max(minWidth, MaxAtlasSize / size);
+
+      int bestWidth = 0;
+      gf::Vector2i bestSize(0, 0);
+
+      // the squarest image, then the smallest
+      auto isBetter = [](gf::Vector2i candidate, gf::Vector2i best) {
+        int candidateSide = std::max(candidate.width, candidate.height);
+        int bestSide = std::max(best.width, best.height);
+
+        if (candidateSide != bestSide) {
+          return candidateSide < bestSide;
+        }
+
+        return int64_t(candidate.width) * candidate.height < int64_t(best.width) * best.height;
+      };
+
+      for (int width = minWidth; width <= maxWidth; ++width) {
+        int height = std::max(packShelves(sizes, width, nullptr), 1);
+        gf::Vector2i candidate = gf::vec(width, height) * size;
+
+        if (db.settings.powerOfTwo) {
+          candidate = gf::vec(roundToPowerOfTwo(candidate.width), roundToPowerOfTwo(candidate.height));
+        }
+
+        if (bestWidth == 0 || isBetter(candidate, bestSize)) {
+          bestWidth = width;
+          bestSize = candidate;
+        }
+      }
+
+      AtlasLayout layout;
+      layout.size = bestSize;
+      layout.positions.resize(sizes.size());
+      packShelves(sizes, bestWidth, &layout.positions);
+      return layout;
+    }
+
+  }
+
+  AtlasLayout computeAtlasLayout(const TilesetData& db) {
+    if (db.settings.packing == AtlasPacking::Compact) {
+      return computeCompactLayout(db);
+    }
+
+    AtlasLayout layout = computeReservedLayout(db);
+
+    if (db.settings.powerOfTwo && layout.size.width > 0) {
+      layout.size = gf::vec(roundToPowerOfTwo(layout.size.width), roundToPowerOfTwo(layout.size.height));
+    }
+
+    return layout;
+  }
+
+}
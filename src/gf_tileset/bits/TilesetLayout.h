@@ -0,0 +1,42 @@
+/*
+ * gf-tools
+ * Copyright (C) 2020 Julien Bernard
+ *
+ * This software is provided 'as-is', without any express or implied
+ * warranty.  In no event will the authors be held liable for any damages
+ * arising from the use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ *    claim that you wrote the original software. If you use this software
+ *    in a product, an acknowledgment in the product documentation would be
+ *    appreciated but is not required.
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ *    misrepresented as being the original software.
+ * 3. This notice may not be removed or altered from any source distribution.
+ */
+#ifndef TILESET_LAYOUT_H
+#define TILESET_LAYOUT_H
+
+#include <vector>
+
+#include <gf/Vector.h>
+
+#include "TilesetData.h"
+
+namespace gftools {
+
+  // where the tilesets are in the atlas, computed once for an export
+  struct AtlasLayout {
+    gf::Vector2i size = gf::vec(0, 0); // in pixels
+    std::vector<gf::Vector2i> positions; // in tiles, the index runs through atoms, then wang2, then wang3
+  };
+
+  AtlasLayout computeAtlasLayout(const TilesetData& db);
+
+}
+
+#endif // TILESET_LAYOUT_H
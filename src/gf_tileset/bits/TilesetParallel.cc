@@ -0,0 +1,143 @@
+/*
+ * gf-tools
+ * Copyright (C) 2020 Julien Bernard
+ *
+ * This software is provided 'as-is', without any express or implied
+ * warranty.  In no event will the authors be held liable for any damages
+ * arising from the use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ *    claim that you wrote the original software. If you use this software
+ *    in a product, an acknowledgment in the product documentation would be
+ *    appreciated but is not required.
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ *    misrepresented as being the original software.
+ * 3. This notice may not be removed or altered from any source distribution.
+ */
+#include "TilesetParallel.h"
+
+#include <utility>
+
+namespace gftools {
+
+  unsigned computeThreadCount(unsigned requested) {
+    if (requested > 0) {
+      return requested;
+    }
+
+    unsigned count = std::thread::hardware_concurrency();
+    return count > 0 ? count : 1;
+  }
+
+  ThreadPool::ThreadPool(unsigned threads)
+  : m_next(0)
+  {
+    unsigned count = computeThreadCount(threads);
+    m_workers.reserve(count - 1);
+
+    for (unsigned i = 1; i < count; ++i) {
+      m_workers.emplace_back(&ThreadPool::work, this);
+    }
+  }
+
+  ThreadPool::~ThreadPool() {
+    {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      m_stop = true;
+    }
+
+    m_start.notify_all();
+
+    for (auto& worker : m_workers) {
+      worker.join();
+    }
+  }
+
+  void ThreadPool::run(std::size_t count, const std::function<void(std::size_t)>& func) {
+    if (m_workers.empty() || count <= 1) {
+      for (std::size_t i = 0; i < count; ++i) {
+        func(i);
+      }
+
+      return;
+    }
+
+    {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      m_func = &func;
+      m_count = count;
+      m_next = 0;
+      m_exception = nullptr;
+      m_active = m_workers.size();
+      ++m_loop;
+    }
+
+    m_start.notify_all();
+    process();
+
+    std::exception_ptr exception;
+
+    {
+      std::unique_lock<std::mutex> lock(m_mutex);
+      m_done.wait(lock, [this]() { return m_active == 0; });
+      m_func = nullptr;
+      exception = std::exchange(m_exception, nullptr);
+    }
+
+    if (exception) {
+      std::rethrow_exception(exception);
+    }
+  }
+
+  void ThreadPool::work() {
+    uint64_t loop = 0;
+
+    for (;;) {
+      {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_start.wait(lock, [&]() { return m_stop || m_loop != loop; });
+
+        if (m_stop) {
+          return;
+        }
+
+        loop = m_loop;
+      }
+
+      process();
+
+      std::lock_guard<std::mutex> lock(m_mutex);
+
+      if (--m_active == 0) {
+        m_done.notify_one();
+      }
+    }
+  }
+
+  void ThreadPool::process() {
+    for (;;) {
+      std::size_t i = m_next.fetch_add(1, std::memory_order_relaxed);
+
+      if (i >= m_count) {
+        return;
+      }
+
+      try {
+        (*m_func)(i);
+      } catch (...) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+
+        if (!m_exception) {
+          m_exception = std::current_exception();
+        }
+
+        m_next = m_count; // the other indices are skipped
+      }
+    }
+  }
+
+}
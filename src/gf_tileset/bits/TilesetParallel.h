@@ -0,0 +1,98 @@
+/*
+ * gf-tools
+ * Copyright (C) 2020 Julien Bernard
+ *
+ * This software is provided 'as-is', without any express or implied
+ * warranty.  In no event will the authors be held liable for any damages
+ * arising from the use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ *    claim that you wrote the original software. If you use this software
+ *    in a product, an acknowledgment in the product documentation would be
+ *    appreciated but is not required.
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ *    misrepresented as being the original software.
+ * 3. This notice may not be removed or altered from any source distribution.
+ */
+#ifndef TILESET_PARALLEL_H
+#define TILESET_PARALLEL_H
+
+#include <cstddef>
+#include <cstdint>
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace gftools {
+
+  // 0 means one thread per hardware core
+  unsigned computeThreadCount(unsigned requested);
+
+  // threads that are created once and run the loops of parallelFor, e.g. all the loops of an export. The thread
+  // that calls run takes part in the loop, so a pool of one thread has no worker.
+  class ThreadPool {
+  public:
+    // 0 means one thread per hardware core
+    explicit ThreadPool(unsigned threads);
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    // the workers and the calling thread
+    unsigned getThreadCount() const {
+      return static_cast<unsigned>(m_workers.size()) + 1;
+    }
+
+    // calls func(i) for i in [0, count) and returns when all the calls are finished. If a call throws, the
+    // indices that are not started yet are skipped and the first exception is thrown again here. Only one loop
+    // at a time.
+    void run(std::size_t count, const std::function<void(std::size_t)>& func);
+
+  private:
+    void work();
+    void process();
+
+  private:
+    std::mutex m_mutex;
+    std::condition_variable m_start;
+    std::condition_variable m_done;
+    std::vector<std::thread> m_workers;
+    const std::function<void(std::size_t)> *m_func = nullptr;
+    std::size_t m_count = 0;
+    std::atomic<std::size_t> m_next;
+    uint64_t m_loop = 0; // incremented for each loop, so that the workers know that a new loop has started
+    std::size_t m_active = 0; // workers that have not finished the current loop
+    std::exception_ptr m_exception;
+    bool m_stop = false;
+  };
+
+  // calls func(i) for i in [0, count), the calls are spread over the threads of the pool
+  template<typename Func>
+  void parallelFor(ThreadPool& pool, std::size_t count, Func func) {
+    pool.run(count, func);
+  }
+
+  // the same with the threads of a single loop, a pool is better for repeated loops
+  template<typename Func>
+  void parallelFor(std::size_t count, unsigned threads, Func func) {
+    if (count == 0) {
+      return;
+    }
+
+    ThreadPool pool(static_cast<unsigned>(std::min(static_cast<std::size_t>(computeThreadCount(threads)), count)));
+    pool.run(count, func);
+  }
+
+}
+
+#endif // TILESET_PARALLEL_H
@@ -0,0 +1,360 @@
+/*
+ * gf-tools
+ * Copyright (C) 2020 Julien Bernard
+ *
+ * This software is provided 'as-is', without any express or implied
+ * warranty.  In no event will the authors be held liable for any damages
+ * arising from the use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ *    claim that you wrote the original software. If you use this software
+ *    in a product, an acknowledgment in the product documentation would be
+ *    appreciated but is not required.
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ *    misrepresented as being the original software.
+ * 3. This notice may not be removed or altered from any source distribution.
+ */
+#include "TilesetPng.h"
+
+#include <cassert>
+#include <cstdlib>
+#include <algorithm>
+#include <atomic>
+
+#include <gf/Log.h>
+
+#include "TilesetParallel.h"
+
+namespace gftools {
+
+  namespace {
+
+    // see https://www.w3.org/TR/png/
+
+    constexpr uint8_t PngSignature[8] = { 0x89, 'P', 'N', 'G', 0x0D, 0x0A, 0x1A, 0x0A };
+    constexpr std::size_t BytesPerPixel = 4;
+    constexpr std::size_t ChunkSize = 256 * 1024; // uncompressed rows in a chunk
+    constexpr std::size_t DictionarySize = 32 * 1024; // the window of deflate
+
+    enum class Filter : uint8_t {
+      None = 0,
+      Sub = 1,
+      Up = 2,
+      Average = 3,
+      Paeth = 4,
+    };
+
+    void storeBigEndian(uint8_t *data, uint32_t value) {
+      data[0] = static_cast<uint8_t>(value >> 24);
+      data[1] = static_cast<uint8_t>(value >> 16);
+      data[2] = static_cast<uint8_t>(value >> 8);
+      data[3] = static_cast<uint8_t>(value);
+    }
+
+    uint8_t paethPredictor(int a, int b, int c) {
+      int p = a + b - c;
+      int pa = std::abs(p - a);
+      int pb = std::abs(p - b);
+      int pc = std::abs(p - c);
+
+      if (pa <= pb && pa <= pc) {
+        return static_cast<uint8_t>(a);
+      }
+
+      if (pb <= pc) {
+        return static_cast<uint8_t>(b);
+      }
+
+      return static_cast<uint8_t>(c);
+    }
+
+    // filtered[0] is the filter type, the rest is the filtered row, returns the sum of absolute differences
+    unsigned applyFilter(Filter filter, const uint8_t *row, const uint8_t *previous, std::size_t size, uint8_t *filtered) {
+      filtered[0] = static_cast<uint8_t>(filter);
+      unsigned sum = 0;
+
+      for (std::size_t i = 0; i < size; ++i) {
+        int left = i >= BytesPerPixel ? row[i - BytesPerPixel] : 0;
+        int up = previous[i];
+        int upLeft = i >= BytesPerPixel ? previous[i - BytesPerPixel] : 0;
+        uint8_t predicted = 0;
+
+        switch (filter) {
+          case Filter::None:
+            break;
+          case Filter::Sub:
+            predicted = static_cast<uint8_t>(left);
+            break;
+          case Filter::Up:
+            predicted = static_cast<uint8_t>(up);
+            break;
+          case Filter::Average:
+            predicted = static_cast<uint8_t>((left + up) / 2);
+            break;
+          case Filter::Paeth:
+            predicted = paethPredictor(left, up, upLeft);
+            break;
+        }
+
+        uint8_t value = static_cast<uint8_t>(row[i] - predicted);
+        filtered[i + 1] = value;
+        sum += static_cast<unsigned>(std::abs(static_cast<int8_t>(value)));
+      }
+
+      return sum;
+    }
+
+  }
+
+  PngWriter::PngWriter()
+  : m_size(0, 0)
+  , m_row(0)
+  , m_level(DefaultCompression)
+  , m_pool(nullptr)
+  , m_open(false)
+  , m_adler(0)
+  {
+  }
+
+  bool PngWriter::open(const gf::Path& filename, gf::Vector2i size, int level, ThreadPool& pool) {
+    assert(!m_open);
+    m_file.open(filename, std::ios::binary | std::ios::trunc);
+
+    if (!m_file) {
+      return false;
+    }
+
+    m_size = size;
+    m_row = 0;
+    m_level = std::clamp(level, Z_NO_COMPRESSION, Z_BEST_COMPRESSION);
+    m_pool = &pool;
+    m_adler = adler32(0L, Z_NULL, 0);
+
+    std::size_t rowSize = static_cast<std::size_t>(size.width) * BytesPerPixel;
+    m_previous.assign(rowSize, 0);
+    m_dictionary.clear();
+
+    m_file.write(reinterpret_cast<const char *>(PngSignature), sizeof PngSignature);
+
+    uint8_t header[13];
+    storeBigEndian(header, static_cast<uint32_t>(size.width));
+    storeBigEndian(header + 4, static_cast<uint32_t>(size.height));
+    header[8] = 8;  // bit depth
+    header[9] = 6;  // color type: RGBA
+    header[10] = 0; // compression method: deflate
+    header[11] = 0; // filter method: adaptive
+    header[12] = 0; // no interlace
+    writeChunk("IHDR", header, sizeof header);
+
+    // zlib header, see RFC 1950, the chunks are raw deflate data that follow
+    int compressionLevel = m_level < 2 ? 0 : (m_level < 6 ? 1 : (m_level == 6 ? 2 : 3));
+    uint8_t zlibHeader[2] = { 0x78, static_cast<uint8_t>(compressionLevel << 6) };
+    zlibHeader[1] = static_cast<uint8_t>(zlibHeader[1] + 31 - (zlibHeader[0] * 256 + zlibHeader[1]) % 31);
+    writeChunk("IDAT", zlibHeader, sizeof zlibHeader);
+
+    m_open = true;
+    return static_cast<bool>(m_file);
+  }
+
+  bool PngWriter::writeRows(const uint8_t *pixels, int count) {
+    assert(m_open);
+    assert(m_row + count <= m_size.height);
+
+    if (count == 0) {
+      return true;
+    }
+
+    std::size_t rowSize = m_previous.size();
+    int rowsPerChunk = static_cast<int>(std::max(ChunkSize / std::max(rowSize, std::size_t(1)), std::size_t(1)));
+    std::size_t chunkCount = static_cast<std::size_t>((count + rowsPerChunk - 1) / rowsPerChunk);
+    m_chunks.resize(chunkCount);
+
+    // the chunks are filtered first, so that each chunk can use the end of the previous one as a dictionary
+
+    parallelFor(*m_pool, chunkCount, [&](std::size_t i) {
+      int first = static_cast<int>(i) * rowsPerChunk;
+      int last = std::min(first + rowsPerChunk, count);
+      const uint8_t *previous = first == 0 ? m_previous.data() : pixels + (first - 1) * rowSize;
+      filterRows(pixels + first * rowSize, previous, last - first, m_chunks[i].filtered);
+    });
+
+    std::atomic<bool> ok(true);
+
+    parallelFor(*m_pool, chunkCount, [&](std::size_t i) {
+      const std::vector<uint8_t>& dictionary = i == 0 ? m_dictionary : m_chunks[i - 1].filtered;
+      std::size_t dictionarySize = std::min(dictionary.size(), DictionarySize);
+
+      if (!compressChunk(m_chunks[i], dictionary.data() + dictionary.size() - dictionarySize, dictionarySize)) {
+        ok = false;
+      }
+    });
+
+    if (!ok) {
+      gf::Log::error("Could not compress the image\n");
+      return false;
+    }
+
+    for (auto& chunk : m_chunks) {
+      m_adler = adler32_combine(m_adler, chunk.adler, static_cast<z_off_t>(chunk.filtered.size()));
+      writeChunk("IDAT", chunk.compressed.data(), chunk.compressed.size());
+    }
+
+    // keep what is needed for the next rows
+
+    const std::vector<uint8_t>& last = m_chunks.back().filtered;
+
+    if (last.size() >= DictionarySize) {
+      m_dictionary.assign(last.end() - DictionarySize, last.end());
+    } else {
+      m_dictionary.insert(m_dictionary.end(), last.begin(), last.end());
+
+      if (m_dictionary.size() > DictionarySize) {
+        m_dictionary.erase(m_dictionary.begin(), m_dictionary.end() - DictionarySize);
+      }
+    }
+
+    std::copy(pixels + (count - 1) * rowSize, pixels + count * rowSize, m_previous.begin());
+    m_row += count;
+    return static_cast<bool>(m_file);
+  }
+
+  bool PngWriter::writeEmptyRows(int count) {
+    std::size_t rowSize = m_previous.size();
+    int rowsPerBlock = std::min(count, static_cast<int>(std::max(ChunkSize / std::max(rowSize, std::size_t(1)), std::size_t(1))) * 16);
+    std::vector<uint8_t> empty(rowSize * std::max(rowsPerBlock, 0), 0);
+
+    while (count > 0) {
+      int rows = std::min(count, rowsPerBlock);
+
+      if (!writeRows(empty.data(), rows)) {
+        return false;
+      }
+
+      count -= rows;
+    }
+
+    return true;
+  }
+
+  bool PngWriter::close() {
+    assert(m_open);
+
+    if (m_row != m_size.height) {
+      gf::Log::error("Missing rows in the image: %d/%d\n", m_row, m_size.height);
+    }
+
+    // an empty final block with fixed codes, then the checksum of the uncompressed data
+    uint8_t trailer[6] = { 0x03, 0x00 };
+    storeBigEndian(trailer + 2, static_cast<uint32_t>(m_adler));
+    writeChunk("IDAT", trailer, sizeof trailer);
+    writeChunk("IEND", nullptr, 0);
+
+    m_open = false;
+    m_chunks.clear();
+    m_dictionary.clear();
+    m_file.close();
+    return m_row == m_size.height && static_cast<bool>(m_file);
+  }
+
+  void PngWriter::filterRows(const uint8_t *rows, const uint8_t *previous, int count, std::vector<uint8_t>& filtered) const {
+    std::size_t rowSize = m_previous.size();
+    filtered.resize((rowSize + 1) * count);
+    std::vector<uint8_t> candidate(m_level == Z_NO_COMPRESSION ? 0 : rowSize + 1);
+
+    for (int y = 0; y < count; ++y) {
+      const uint8_t *row = rows + y * rowSize;
+      uint8_t *destination = filtered.data() + y * (rowSize + 1);
+      unsigned best = applyFilter(Filter::None, row, previous, rowSize, destination);
+
+      if (m_level != Z_NO_COMPRESSION) {
+        // heuristic from the specification: the filter with the minimum sum of absolute differences
+        for (auto filter : { Filter::Sub, Filter::Up, Filter::Average, Filter::Paeth }) {
+          unsigned sum = applyFilter(filter, row, previous, rowSize, candidate.data());
+
+          if (sum < best) {
+            best = sum;
+            std::copy(candidate.begin(), candidate.end(), destination);
+          }
+        }
+      }
+
+      previous = row;
+    }
+  }
+
+  bool PngWriter::compressChunk(Chunk& chunk, const uint8_t *dictionary, std::size_t dictionarySize) const {
+    z_stream stream = z_stream();
+
+    // raw deflate data, the zlib header and checksum are written by the writer
+    if (deflateInit2(&stream, m_level, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+      return false;
+    }
+
+    if (dictionarySize > 0 && deflateSetDictionary(&stream, dictionary, static_cast<uInt>(dictionarySize)) != Z_OK) {
+      deflateEnd(&stream);
+      return false;
+    }
+
+    // the sync flush ends the data on a byte boundary, without a final block
+    chunk.compressed.resize(deflateBound(&stream, static_cast<uLong>(chunk.filtered.size())) + 16);
+    stream.next_in = chunk.filtered.data();
+    stream.avail_in = static_cast<uInt>(chunk.filtered.size());
+
+    std::size_t produced = 0;
+    bool ok = true;
+
+    for (;;) {
+      stream.next_out = chunk.compressed.data() + produced;
+      stream.avail_out = static_cast<uInt>(chunk.compressed.size() - produced);
+      int status = deflate(&stream, Z_SYNC_FLUSH);
+      produced = chunk.compressed.size() - stream.avail_out;
+
+      if (status != Z_OK && status != Z_BUF_ERROR) {
+        ok = false;
+        break;
+      }
+
+      if (stream.avail_out > 0) {
+        break;
+      }
+
+      chunk.compressed.resize(chunk.compressed.size() * 2);
+    }
+
+    ok = ok && stream.avail_in == 0;
+    chunk.compressed.resize(produced);
+    deflateEnd(&stream);
+
+    chunk.adler = adler32(adler32(0L, Z_NULL, 0), chunk.filtered.data(), static_cast<uInt>(chunk.filtered.size()));
+    return ok;
+  }
+
+  void PngWriter::writeChunk(const char *type, const uint8_t *data, std::size_t size) {
+    uint8_t length[4];
+    storeBigEndian(length, static_cast<uint32_t>(size));
+
+    uLong crc = crc32(0L, Z_NULL, 0);
+    crc = crc32(crc, reinterpret_cast<const Bytef *>(type), 4);
+
+    if (size > 0) {
+      crc = crc32(crc, data, static_cast<uInt>(size));
+    }
+
+    uint8_t checksum[4];
+    storeBigEndian(checksum, static_cast<uint32_t>(crc));
+
+    m_file.write(reinterpret_cast<const char *>(length), sizeof length);
+    m_file.write(type, 4);
+
+    if (size > 0) {
+      m_file.write(reinterpret_cast<const char *>(data), static_cast<std::streamsize>(size));
+    }
+
+    m_file.write(reinterpret_cast<const char *>(checksum), sizeof checksum);
+  }
+
+}
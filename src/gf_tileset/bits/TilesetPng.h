@@ -0,0 +1,85 @@
+/*
+ * gf-tools
+ * Copyright (C) 2020 Julien Bernard
+ *
+ * This software is provided 'as-is', without any express or implied
+ * warranty.  In no event will the authors be held liable for any damages
+ * arising from the use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ *    claim that you wrote the original software. If you use this software
+ *    in a product, an acknowledgment in the product documentation would be
+ *    appreciated but is not required.
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ *    misrepresented as being the original software.
+ * 3. This notice may not be removed or altered from any source distribution.
+ */
+#ifndef TILESET_PNG_H
+#define TILESET_PNG_H
+
+#include <cstdint>
+#include <fstream>
+#include <vector>
+
+#include <gf/Path.h>
+#include <gf/Vector.h>
+
+#include <zlib.h>
+
+namespace gftools {
+
+  class ThreadPool;
+
+  // RGBA png written row by row, so that the whole image is never in memory. The rows are split in chunks
+  // that are filtered and compressed in parallel, then concatenated in a single deflate stream.
+  class PngWriter {
+  public:
+    static constexpr int DefaultCompression = 6;
+
+    PngWriter();
+
+    PngWriter(const PngWriter&) = delete;
+    PngWriter& operator=(const PngWriter&) = delete;
+
+    // level is the zlib level, 0 stores the rows without filtering nor compression. The chunks are processed by
+    // the threads of the pool, that must live until the image is closed
+    bool open(const gf::Path& filename, gf::Vector2i size, int level, ThreadPool& pool);
+
+    // rows are tightly packed
+    bool writeRows(const uint8_t *pixels, int count);
+    bool writeEmptyRows(int count);
+
+    // must be called after the last row
+    bool close();
+
+  private:
+    struct Chunk {
+      std::vector<uint8_t> filtered;
+      std::vector<uint8_t> compressed;
+      uLong adler;
+    };
+
+    void filterRows(const uint8_t *rows, const uint8_t *previous, int count, std::vector<uint8_t>& filtered) const;
+    bool compressChunk(Chunk& chunk, const uint8_t *dictionary, std::size_t dictionarySize) const;
+    void writeChunk(const char *type, const uint8_t *data, std::size_t size);
+
+  private:
+    std::ofstream m_file;
+    gf::Vector2i m_size;
+    int m_row;
+    int m_level;
+    ThreadPool *m_pool;
+    bool m_open;
+    uLong m_adler;
+    std::vector<uint8_t> m_previous;
+    std::vector<uint8_t> m_dictionary;
+    std::vector<Chunk> m_chunks;
+  };
+
+}
+
+#endif // TILESET_PNG_H
@@ -0,0 +1,165 @@
+/*
+ * gf-tools
+ * Copyright (C) 2020 Julien Bernard
+ *
+ * This software is provided 'as-is', without any express or implied
+ * warranty.  In no event will the authors be held liable for any damages
+ * arising from the use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ *    claim that you wrote the original software. If you use this software
+ *    in a product, an acknowledgment in the product documentation would be
+ *    appreciated but is not required.
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ *    misrepresented as being the original software.
+ * 3. This notice may not be removed or altered from any source distribution.
+ */
+#include "TilesetPreview.h"
+
+#include <algorithm>
+#include <iterator>
+
+#include "TilesetCache.h"
+#include "TilesetProcess.h"
+
+namespace gftools {
+
+  PreviewWorker::PreviewWorker(gf::Random random)
+  : m_random(std::move(random))
+  , m_thread(&PreviewWorker::run, this)
+  {
+  }
+
+  PreviewWorker::~PreviewWorker() {
+    {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      m_stop = true;
+    }
+
+    m_condition.notify_one();
+    m_thread.join();
+  }
+
+  void PreviewWorker::requestAtomPreview(const Atom& atom, const TilesetData& db) {
+    TilesetData data = db.extract({ });
+    data.temporary.atom = atom;
+    submit(PreviewKind::Atom, std::move(data));
+  }
+
+  void PreviewWorker::requestWang2Preview(const Wang2& wang, const TilesetData& db) {
+    TilesetData data = db.extract({ wang.borders[0].id.hash, wang.borders[1].id.hash });
+    data.temporary.wang2 = wang;
+    submit(PreviewKind::Wang2, std::move(data));
+  }
+
+  void PreviewWorker::requestWang3Preview(const Wang3& wang, const TilesetData& db) {
+    submit(PreviewKind::Wang3, db.extract({ wang.ids[0].hash, wang.ids[1].hash, wang.ids[2].hash }), wang);
+  }
+
+  bool PreviewWorker::takePreview(PreviewKind kind, gf::Image& image) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    Result& result = m_results[static_cast<std::size_t>(kind)];
+
+    if (!result.ready) {
+      return false;
+    }
+
+    image = std::move(result.image);
+    result.ready = false;
+    return true;
+  }
+
+  void PreviewWorker::submit(PreviewKind kind, TilesetData db, Wang3 wang3) {
+    {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      Request& request = m_requests[static_cast<std::size_t>(kind)];
+      request.id = ++m_lastId;
+      request.pending = true;
+      request.db = std::move(db);
+      request.wang3 = std::move(wang3);
+    }
+
+    m_condition.notify_one();
+  }
+
+  void PreviewWorker::run() {
+    for (;;) {
+      std::size_t kind = KindCount;
+      Request request;
+
+      {
+        std::unique_lock<std::mutex> lock(m_mutex);
+
+        m_condition.wait(lock, [this]() {
+          return m_stop || std::any_of(std::begin(m_requests), std::end(m_requests), [](const Request& request) { return request.pending; });
+        });
+
+        if (m_stop) {
+          return;
+        }
+
+        // the oldest pending request first, so that a kind can not starve the others
+
+        for (std::size_t i = 0; i < KindCount; ++i) {
+          if (m_requests[i].pending && (kind == KindCount || m_requests[i].id < m_requests[kind].id)) {
+            kind = i;
+          }
+        }
+
+        request = std::move(m_requests[kind]);
+        m_requests[kind].pending = false;
+      }
+
+      gf::Image image;
+
+      switch (static_cast<PreviewKind>(kind)) {
+        case PreviewKind::Atom:
+          image = generateAtomPreview(request.db.temporary.atom, m_random, request.db.settings.tile);
+          break;
+        case PreviewKind::Wang2: {
+          const Wang2& wang = request.db.temporary.wang2;
+          Geometry& geometry = m_geometries[kind];
+          uint64_t key = TilesetCache::computeGeometryKey(request.db, wang);
+
+          if (!geometry.valid || geometry.key != key) {
+            geometry.tileset = generateTwoCornersWangTileset(wang, TileRandom(key), request.db);
+            geometry.key = key;
+            geometry.valid = true;
+          }
+
+          image = generateWang2Preview(geometry.tileset, m_random, request.db);
+          break;
+        }
+        case PreviewKind::Wang3: {
+          Geometry& geometry = m_geometries[kind];
+          uint64_t key = TilesetCache::computeGeometryKey(request.db, request.wang3);
+
+          if (!geometry.valid || geometry.key != key) {
+            geometry.tileset = generateThreeCornersWangTileset(request.wang3, TileRandom(key), request.db);
+            geometry.key = key;
+            geometry.valid = true;
+          }
+
+          image = generateWang3Preview(geometry.tileset, m_random, request.db);
+          break;
+        }
+      }
+
+      std::lock_guard<std::mutex> lock(m_mutex);
+
+      // a newer request for the same kind supersedes this one
+      if (m_requests[kind].pending && m_requests[kind].id > request.id) {
+        continue;
+      }
+
+      Result& result = m_results[kind];
+      result.ready = true;
+      result.image = std::move(image);
+    }
+  }
+
+}
@@ -0,0 +1,99 @@
+/*
+ * gf-tools
+ * Copyright (C) 2020 Julien Bernard
+ *
+ * This software is provided 'as-is', without any express or implied
+ * warranty.  In no event will the authors be held liable for any damages
+ * arising from the use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ *    claim that you wrote the original software. If you use this software
+ *    in a product, an acknowledgment in the product documentation would be
+ *    appreciated but is not required.
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ *    misrepresented as being the original software.
+ * 3. This notice may not be removed or altered from any source distribution.
+ */
+#ifndef TILESET_PREVIEW_H
+#define TILESET_PREVIEW_H
+
+#include <cstdint>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+#include <gf/Image.h>
+#include <gf/Random.h>
+
+#include "TilesetData.h"
+#include "TilesetGeneration.h"
+
+namespace gftools {
+
+  enum class PreviewKind : std::size_t {
+    Atom,
+    Wang2,
+    Wang3,
+  };
+
+  // previews are generated in a background thread, a new request supersedes the previous requests of the
+  // same kind, and only the result of the latest request is given back
+  class PreviewWorker {
+  public:
+    PreviewWorker(gf::Random random);
+    ~PreviewWorker();
+
+    PreviewWorker(const PreviewWorker&) = delete;
+    PreviewWorker& operator=(const PreviewWorker&) = delete;
+
+    void requestAtomPreview(const Atom& atom, const TilesetData& db);
+    void requestWang2Preview(const Wang2& wang, const TilesetData& db);
+    void requestWang3Preview(const Wang3& wang, const TilesetData& db);
+
+    // true if a new preview is available, to call in the render thread
+    bool takePreview(PreviewKind kind, gf::Image& image);
+
+  private:
+    static constexpr std::size_t KindCount = 3;
+
+    struct Request {
+      uint64_t id = 0;
+      bool pending = false;
+      TilesetData db; // only what the preview needs (see TilesetData::extract), with the edited element in temporary
+      Wang3 wang3;
+    };
+
+    struct Result {
+      bool ready = false;
+      gf::Image image;
+    };
+
+    // the geometry of the last preview of a kind, kept while only the colors change
+    struct Geometry {
+      uint64_t key = 0;
+      bool valid = false;
+      Tileset tileset = Tileset(gf::vec(0, 0));
+    };
+
+    void submit(PreviewKind kind, TilesetData db, Wang3 wang3 = Wang3());
+    void run();
+
+  private:
+    std::mutex m_mutex;
+    std::condition_variable m_condition;
+    bool m_stop = false;
+    uint64_t m_lastId = 0;
+    Request m_requests[KindCount];
+    Result m_results[KindCount];
+    Geometry m_geometries[KindCount]; // only used by the worker thread
+    gf::Random m_random; // only used by the worker thread
+    std::thread m_thread;
+  };
+
+}
+
+#endif // TILESET_PREVIEW_H
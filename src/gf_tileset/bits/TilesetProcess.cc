@@ -21,9 +21,14 @@
 #include "TilesetProcess.h"
 
 #include <cinttypes>
+#include <cmath>
 #include <algorithm>
+#include <limits>
+#include <memory>
 #include <sstream>
+#include <unordered_map>
 #include <iomanip>
+#include <iterator>
 
 #include <gf/Color.h>
 #include <gf/Geometry.h>
@@ -32,8 +37,61 @@
 
 #include <gf/Log.h>
 
+#include "TilesetKernels.h"
+#include "TilesetLayout.h"
+#include "TilesetParallel.h"
+
 namespace gftools {
 
+  /*
+   * ColorsView
+   */
+
+  ColorsView ColorsView::subview(gf::Vector2i offset, gf::Vector2i subsize) const {
+    assert(offset.x >= 0);
+    assert(offset.y >= 0);
+    assert(offset.x + subsize.width <= size.width);
+    assert(offset.y + subsize.height <= size.height);
+
+    ColorsView view;
+    view.pixels = pixels + offset.y * stride + offset.x;
+    view.size = subsize;
+    view.stride = stride;
+    return view;
+  }
+
+  void ColorsView::copyTo(ColorsView destination) const {
+    assert(size == destination.size);
+
+    for (int y = 0; y < size.height; ++y) {
+      std::copy_n(row(y), size.width, destination.row(y));
+    }
+  }
+
+  void ColorsView::extend(int space) const {
+    if (space == 0) {
+      return;
+    }
+
+    int first = space;
+    int last = size.height - space - 1;
+    assert(first <= last);
+
+    for (int y = first; y <= last; ++y) {
+      gf::Color4f *line = row(y);
+      std::fill_n(line, space, line[space]);
+      std::fill_n(line + size.width - space, space, line[size.width - space - 1]);
+    }
+
+    for (int y = 0; y < first; ++y) {
+      std::copy_n(row(first), size.width, row(y));
+    }
+
+    for (int y = last + 1; y < size.height; ++y) {
+      std::copy_n(row(last), size.width, row(y));
+    }
+  }
+
   /*
    * Colors
    */
@@ -43,55 +101,207 @@ namespace gftools {
   {
   }
 
-  Colors Colors::extend(int space) const {
+  ColorsView Colors::view() {
+    ColorsView view;
+    view.pixels = data.begin();
+    view.size = data.getSize();
+    view.stride = view.size.width;
+    return view;
+  }
+
+  gf::Image Colors::createImage() const {
     auto size = data.getSize();
-    Colors result(size + 2 * space);
+    std::vector<uint8_t> pixels(static_cast<std::size_t>(size.width) * size.height * 4);
+    convertToRgba32(data.getDataPtr(), static_cast<std::size_t>(size.width) * size.height, pixels.data());
+    return gf::Image(size, pixels.data());
+  }
+
+  /*
+   * DistanceField
+   */
+
+  DistanceField::DistanceField(gf::Vector2i size)
+  : distance(size, Unreachable)
+  , nearest(size, gf::vec(-1, -1))
+  {
+  }
+
+  void DistanceField::compute(const Pixels& pixels, gf::Id target, DistanceMetric metric) {
+    auto size = pixels.data.getSize();
 
-    for (auto pos : result.data.getPositionRange()) {
-      auto sourcePos = gf::clamp(pos - space, gf::vec(0, 0), size - 1);
-      result.data(pos) = data(sourcePos);
+    if (distance.getSize() != size) {
+      distance = gf::Array2D<float, int>(size, Unreachable);
+      nearest = gf::Array2D<gf::Vector2i, int>(size, gf::vec(-1, -1));
+    } else {
+      std::fill(distance.begin(), distance.end(), Unreachable);
+      std::fill(nearest.begin(), nearest.end(), gf::vec(-1, -1));
     }
 
-    return result;
+    switch (metric) {
+      case DistanceMetric::Manhattan:
+        computeManhattan(pixels, target);
+        break;
+      case DistanceMetric::Euclidean:
+        computeEuclidean(pixels, target);
+        break;
+    }
   }
 
-  void Colors::blit(const Colors source, gf::Vector2i offset) {
-    auto srcSize = source.data.getSize();
-    auto dstSize = data.getSize();
+  void DistanceField::computeManhattan(const Pixels& pixels, gf::Id target) {
+    // multi-source BFS, on a 4-connected grid the BFS distance is the manhattan distance. When several targets are
+    // at the same distance, the nearest is the first one in row-major order, as the exhaustive search did before:
+    // the targets at the same distance of a pixel are the ones of its neighbors one step closer, so it is the
+    // first of their nearest targets.
 
-    assert(offset.x >= 0);
-    assert(offset.y >= 0);
-    assert(offset.x + srcSize.width <= dstSize.width);
-    assert(offset.y + srcSize.height <= dstSize.height);
+    auto isBefore = [](gf::Vector2i lhs, gf::Vector2i rhs) {
+      return lhs.y < rhs.y || (lhs.y == rhs.y && lhs.x < rhs.x);
+    };
 
-    for (auto pos : source.data.getPositionRange()) {
-      data(offset + pos) = source.data(pos);
+    auto size = pixels.data.getSize();
+    std::vector<gf::Vector2i> queue;
+    queue.reserve(size.width * size.height);
+
+    uint8_t label = pixels.getLabel(target);
+
+    for (auto pos : pixels.data.getPositionRange()) {
+      if (pixels.data(pos) == label) {
+        distance(pos) = 0.0f;
+        nearest(pos) = pos;
+        queue.push_back(pos);
+      }
+    }
+
+    for (std::size_t head = 0; head < queue.size(); ++head) {
+      auto curr = queue[head];
+      float nextDistance = distance(curr) + 1.0f;
+
+      for (auto next : pixels.data.get4NeighborsRange(curr)) {
+        if (distance(next) == Unreachable) {
+          distance(next) = nextDistance;
+          nearest(next) = nearest(curr);
+          queue.push_back(next);
+        } else if (distance(next) == nextDistance && isBefore(nearest(curr), nearest(next))) {
+          nearest(next) = nearest(curr);
+        }
+      }
     }
   }
 
-  gf::Image Colors::createImage() const {
-    gf::Image image(data.getSize(), gf::Color::toRgba32(gf::Color::Transparent));
+  void DistanceField::computeEuclidean(const Pixels& pixels, gf::Id target) {
+    // see Felzenszwalb and Huttenlocher, Distance Transforms of Sampled Functions
+
+    auto size = pixels.data.getSize();
+    uint8_t label = pixels.getLabel(target);
+
+    // first pass: nearest target in the same column
+
+    gf::Array2D<int, int> column(size, -1);
+
+    for (int x = 0; x < size.width; ++x) {
+      int last = -1;
 
-    for (auto pos : data.getPositionRange()) {
-      gf::Color4f raw = data(pos);
-      gf::Color4u color = gf::Color::toRgba32(raw);
-      image.setPixel(pos, color);
+      for (int y = 0; y < size.height; ++y) {
+        if (pixels.data({ x, y }) == label) {
+          last = y;
+        }
+
+        column({ x, y }) = last;
+      }
+
+      last = -1;
+
+      for (int y = size.height - 1; y >= 0; --y) {
+        if (pixels.data({ x, y }) == label) {
+          last = y;
+        }
+
+        int& row = column({ x, y });
+
+        if (last != -1 && (row == -1 || last - y < y - row)) {
+          row = last;
+        }
+      }
     }
 
-    return image;
+    // second pass: lower envelope of the parabolas of each line
+
+    constexpr float Infinity = std::numeric_limits<float>::infinity();
+
+    std::vector<float> f(size.width);
+    std::vector<int> v(size.width);
+    std::vector<float> z(size.width + 1);
+
+    for (int y = 0; y < size.height; ++y) {
+      for (int x = 0; x < size.width; ++x) {
+        int row = column({ x, y });
+        f[x] = (row == -1) ? Infinity : static_cast<float>(gf::square(row - y));
+      }
+
+      int k = -1;
+
+      for (int q = 0; q < size.width; ++q) {
+        if (f[q] == Infinity) {
+          continue;
+        }
+
+        if (k == -1) {
+          k = 0;
+          v[0] = q;
+          z[0] = -Infinity;
+          z[1] = +Infinity;
+          continue;
+        }
+
+        float s = 0.0f;
+
+        for (;;) {
+          int p = v[k];
+          s = ((f[q] + gf::square(q)) - (f[p] + gf::square(p))) / (2.0f * (q - p));
+
+          if (s > z[k]) {
+            break;
+          }
+
+          --k;
+        }
+
+        ++k;
+        v[k] = q;
+        z[k] = s;
+        z[k + 1] = +Infinity;
+      }
+
+      if (k == -1) {
+        continue;
+      }
+
+      int j = 0;
+
+      for (int x = 0; x < size.width; ++x) {
+        while (z[j + 1] < x) {
+          ++j;
+        }
+
+        int p = v[j];
+        distance({ x, y }) = std::sqrt(gf::square(x - p) + f[p]);
+        nearest({ x, y }) = gf::vec(p, column({ p, y }));
+      }
+    }
   }
 
   namespace {
 
-    void colorizeAtom(Colors& colors, const Atom& atom, const Tile& tile, gf::Random& random) {
+    void colorizeAtom(ColorsView colors, const Atom& atom, const Tile& tile, gf::Random& random) {
       if (atom.id.hash == Void) {
         return;
       }
 
+      uint8_t label = tile.pixels.getLabel(atom.id.hash);
+
       switch (atom.pigment.style) {
         case PigmentStyle::Plain:
           for (auto pos : tile.pixels.data.getPositionRange()) {
-            if (tile.pixels(pos) != atom.id.hash) {
+            if (tile.pixels.data(pos) != label) {
               continue;
             }
 
@@ -101,7 +311,7 @@ namespace gftools {
 
         case PigmentStyle::Randomize: {
           for (auto pos : tile.pixels.data.getPositionRange()) {
-            if (tile.pixels(pos) != atom.id.hash) {
+            if (tile.pixels.data(pos) != label) {
               continue;
             }
 
@@ -114,9 +324,7 @@ namespace gftools {
           for (int i = 0; i < anomalies; ++i) {
             gf::Vector2i pos = random.computePosition(gf::RectI::fromSize(size - atom.pigment.randomize.size));
 
-            gf::Id id = tile.pixels(pos);
-
-            if (id != atom.id.hash) {
+            if (tile.pixels.data(pos) != label) {
               continue;
             }
 
@@ -130,7 +338,7 @@ namespace gftools {
                 auto neighbor = pos + offset;
                 assert(tile.pixels.data.isValid(neighbor));
 
-                if (tile.pixels(neighbor) == id) {
+                if (tile.pixels.data(neighbor) == label) {
                   colors(neighbor) = modified;
                 }
               }
@@ -142,7 +350,7 @@ namespace gftools {
 
         case PigmentStyle::Striped:
           for (auto pos : tile.pixels.data.getPositionRange()) {
-            if (tile.pixels(pos) != atom.id.hash) {
+            if (tile.pixels.data(pos) != label) {
               continue;
             }
 
@@ -164,7 +372,7 @@ namespace gftools {
           };
 
           for (auto pos : tile.pixels.data.getPositionRange()) {
-            if (tile.pixels(pos) != atom.id.hash) {
+            if (tile.pixels.data(pos) != label) {
               continue;
             }
 
@@ -194,7 +402,150 @@ namespace gftools {
     }
 
 
-    void colorizeBorder(Colors& colors, const Colors& originalColors, const Wang2& wang, const Tile& tile, gf::Random& random, const TilesetData& db) {
+    class DistanceFieldCache {
+    public:
+      DistanceFieldCache(DistanceMetric metric)
+      : m_metric(metric)
+      {
+      }
+
+      // the fields are kept between tiles so that their storage is reused
+      void reset(const Pixels& pixels) {
+        m_pixels = &pixels;
+        m_count = 0;
+      }
+
+      const DistanceField& operator()(gf::Id target) {
+        assert(m_pixels != nullptr);
+
+        for (std::size_t i = 0; i < m_count; ++i) {
+          if (m_targets[i] == target) {
+            return m_fields[i];
+          }
+        }
+
+        assert(m_count < MaxFields);
+        m_targets[m_count] = target;
+        m_fields[m_count].compute(*m_pixels, target, m_metric);
+        return m_fields[m_count++];
+      }
+
+    private:
+      static constexpr std::size_t MaxFields = 3; // see Origin
+
+      const Pixels *m_pixels = nullptr;
+      DistanceMetric m_metric;
+      std::size_t m_count = 0;
+      gf::Id m_targets[MaxFields];
+      DistanceField m_fields[MaxFields];
+    };
+
+    // the blurred tile, computed at most once per tile
+    class BlurredColors {
+    public:
+      void reset(const Colors& original) {
+        m_original = &original;
+        m_computed = false;
+      }
+
+      const Colors& operator()() {
+        assert(m_original != nullptr);
+
+        if (!m_computed) {
+          auto size = m_original->data.getSize();
+
+          if (m_blurred.data.getSize() != size) {
+            m_blurred = Colors(size);
+            m_buffer = Colors(size);
+          }
+
+          blurBinomial5(m_original->data.getDataPtr(), m_blurred.data.begin(), m_buffer.data.begin(), size);
+          m_computed = true;
+        }
+
+        return m_blurred;
+      }
+
+    private:
+      const Colors *m_original = nullptr;
+      bool m_computed = false;
+      Colors m_blurred;
+      Colors m_buffer;
+    };
+
+    // the color is initialized with the original color, returns true if the border changed the color
+    bool applyBorderEffect(gf::Color4f& color, gf::Vector2i pos, const Border& border, const Border& other, const Atom& atom, float minDistance, gf::Vector2i minNeighbor, const Colors& originalColors, BlurredColors& blurred, gf::Random& random) {
+      bool changed = false;
+
+      switch (border.effect) {
+        case BorderEffect::Fade:
+          if (minDistance <= border.fade.distance) {
+            changed = true;
+            color.a = gf::lerp(color.a, 0.0f, (border.fade.distance - minDistance) / static_cast<float>(border.fade.distance));
+          }
+          break;
+
+        case BorderEffect::Outline:
+          if (minDistance <= border.outline.distance) {
+            changed = true;
+            color = gf::Color::darker(atom.color, border.outline.factor);
+          }
+          break;
+
+        case BorderEffect::Sharpen:
+          if (minDistance <= border.sharpen.distance) {
+            changed = true;
+            color = gf::Color::darker(color, (border.sharpen.distance - minDistance) * 0.5f / border.sharpen.distance);
+          }
+          break;
+
+        case BorderEffect::Lighten:
+          if (minDistance <= border.sharpen.distance) {
+            changed = true;
+            color = gf::Color::lighter(color, (border.lighten.distance - minDistance) * 0.5f / border.lighten.distance);
+          }
+          break;
+
+        case BorderEffect::Blur:
+          if (minDistance < 5) {
+            changed = true;
+
+            color = blurred()(pos);
+          }
+          break;
+
+        case BorderEffect::Blend:
+          if (minDistance <= border.blend.distance) {
+            float stop = 1.0f;
+
+            if (other.effect == BorderEffect::Blend) {
+              stop = 0.5f;
+            }
+
+            changed = true;
+            color = gf::lerp(color, originalColors(minNeighbor), stop * (border.blend.distance - minDistance) / static_cast<float>(border.blend.distance) + random.computeUniformFloat(0.0f, 0.05f));
+          }
+          break;
+
+        default:
+          assert(false);
+          break;
+      }
+
+      return changed;
+    }
+
+    const Wang2 *findBorders(const TilesetData& db, gf::Id id0, gf::Id id1, Search search) {
+      auto wang = db.getWang2(id0, id1, search);
+
+      if (wang == nullptr) {
+        gf::Log::warning("No wang2 for this pair of atoms: (%s, %s)\n", db.getAtom(id0, search).id.name.c_str(), db.getAtom(id1, search).id.name.c_str());
+      }
+
+      return wang;
+    }
+
+    void colorizeBorder(ColorsView colors, const Colors& originalColors, BlurredColors& blurred, const Wang2& wang, const Tile& tile, gf::Random& random, const TilesetData& db, DistanceFieldCache& fields) {
       for (int i = 0; i < 2; ++i) {
         auto& border = wang.borders[i];
 
@@ -208,295 +559,560 @@ namespace gftools {
           continue;
         }
 
-        Atom atom = db.getAtom(id);
+        const Atom& atom = db.getAtom(id);
 
         gf::Id other = wang.borders[1 - i].id.hash;
+        const DistanceField& field = fields(other);
+        uint8_t label = tile.pixels.getLabel(id);
 
         for (auto pos : tile.pixels.data.getPositionRange()) {
-          if (tile.pixels(pos) != id) {
+          if (tile.pixels.data(pos) != label) {
             continue;
           }
 
-          int minDistance = 1'000'000;
-          gf::Vector2i minNeighbor(-1, -1);
+          auto color = originalColors(pos);
 
-          for (auto neighbor : tile.pixels.data.getPositionRange()) {
-            if (tile.pixels(neighbor) != other) {
-              continue;
-            }
+          if (applyBorderEffect(color, pos, border, wang.borders[1 - i], atom, field.distance(pos), field.nearest(pos), originalColors, blurred, random)) {
+            colors(pos) = color;
+          }
+        }
+      }
+    }
 
-            int distance = gf::manhattanDistance(pos, neighbor);
+    // all the borders of a three biomes tile in a single sweep, each pixel gets the effect of the border
+    // with the nearest foreign biome
+    void colorizeBorders(ColorsView colors, const Colors& originalColors, BlurredColors& blurred, const Tile& tile, gf::Random& random, const TilesetData& db, Search search, DistanceFieldCache& fields) {
+      struct Side {
+        const Border *border = nullptr;
+        const Border *other = nullptr;
+        const DistanceField *field = nullptr;
+      };
 
-            if (distance < minDistance) {
-              minDistance = distance;
-              minNeighbor = neighbor;
-            }
-          }
+      struct Biome {
+        const Atom *atom = nullptr;
+        Side sides[2];
+      };
 
-          auto color = originalColors(pos);
-          bool changed = false;
+      // indexed by label
+      Biome biomes[Pixels::PaletteSize];
 
-          switch (border.effect) {
-            case BorderEffect::Fade:
-              if (minDistance <= border.fade.distance) {
-                changed = true;
-                color.a = gf::lerp(color.a, 0.0f, (border.fade.distance - minDistance) / static_cast<float>(border.fade.distance));
-              }
-              break;
+      auto& origin = tile.origin;
+      assert(origin.count == 3);
 
-            case BorderEffect::Outline:
-              if (minDistance <= border.outline.distance) {
-                changed = true;
-                color = gf::Color::darker(atom.color, border.outline.factor);
-              }
-              break;
+      for (int i = 0; i < 3; ++i) {
+        gf::Id id = origin.ids[i];
 
-            case BorderEffect::Sharpen:
-              if (minDistance <= border.sharpen.distance) {
-                changed = true;
-                color = gf::Color::darker(color, (border.sharpen.distance - minDistance) * 0.5f / border.sharpen.distance);
-              }
-              break;
+        if (id == Void) {
+          continue;
+        }
 
-            case BorderEffect::Lighten:
-              if (minDistance <= border.sharpen.distance) {
-                changed = true;
-                color = gf::Color::lighter(color, (border.lighten.distance - minDistance) * 0.5f / border.lighten.distance);
-              }
-              break;
-
-            case BorderEffect::Blur:
-              if (minDistance < 5) {
-                changed = true;
-
-                // see https://en.wikipedia.org/wiki/Kernel_(image_processing)
-
-                float finalCoeff = 36.0f;
-                gf::Color4f finalColor = 36.0f * originalColors(pos);
-
-                for (auto next : originalColors.data.get24NeighborsRange(pos)) {
-                  gf::Color4f nextColor = originalColors(next);
-                  gf::Vector2i diff = gf::abs(pos - next);
-
-                  if (diff == gf::Vector2i(1, 0) || diff == gf::Vector2i(0, 1)) {
-                    finalColor += 24.0f * nextColor;
-                    finalCoeff += 24.0f;
-                  } else if (diff == gf::Vector2i(1, 1)) {
-                    finalColor += 16.0f * nextColor;
-                    finalCoeff += 16.0f;
-                  } else if (diff == gf::Vector2i(2, 0) || diff == gf::Vector2i(0, 2)) {
-                    finalColor += 6.0f * nextColor;
-                    finalCoeff += 6.0f;
-                  } else if (diff == gf::Vector2i(2, 1) || diff == gf::Vector2i(1, 2)) {
-                    finalColor += 4.0f * nextColor;
-                    finalCoeff += 4.0f;
-                  } else if (diff == gf::Vector2i(2, 2)) {
-                    finalColor += 1.0f * nextColor;
-                    finalCoeff += 1.0f;
-                  } else {
-                    assert(false);
-                  }
-                }
+        uint8_t label = tile.pixels.getLabel(id);
 
-                color = finalColor / finalCoeff;
-              }
-              break;
+        if (label == Pixels::NoLabel) {
+          continue;
+        }
 
-            case BorderEffect::Blend:
-              if (minDistance <= border.blend.distance) {
-                float stop = 1.0f;
+        Biome& biome = biomes[label];
+        biome.atom = &db.getAtom(id, search);
 
-                if (wang.borders[1 - i].effect == BorderEffect::Blend) {
-                  stop = 0.5f;
-                }
+        for (int k = 0; k < 2; ++k) {
+          gf::Id foreign = origin.ids[(i + k + 1) % 3];
+          Side& side = biome.sides[k];
+          side.field = &fields(foreign);
 
-                changed = true;
-                color = gf::lerp(color, originalColors(minNeighbor), stop * (border.blend.distance - minDistance) / static_cast<float>(border.blend.distance) + random.computeUniformFloat(0.0f, 0.05f));
-              }
-              break;
+          // a missing wang2 has no border effect
+          const Wang2 *wang = findBorders(db, id, foreign, search);
 
-            default:
-              assert(false);
-              break;
+          if (wang == nullptr) {
+            continue;
           }
 
-          if (changed) {
-            colors(pos) = color;
+          int own = wang->borders[0].id.hash == id ? 0 : 1;
+
+          if (wang->borders[own].effect != BorderEffect::None) {
+            side.border = &wang->borders[own];
+            side.other = &wang->borders[1 - own];
+          }
+        }
+      }
+
+      for (auto pos : tile.pixels.data.getPositionRange()) {
+        Biome& biome = biomes[tile.pixels.data(pos)];
+
+        if (biome.atom == nullptr) {
+          continue;
+        }
+
+        // the nearest foreign biome, even if its border has no effect
+
+        const Side *nearest = nullptr;
+        float minDistance = DistanceField::Unreachable;
+
+        for (int k = 0; k < 2; ++k) {
+          float distance = biome.sides[k].field->distance(pos);
+
+          if (distance < minDistance) {
+            minDistance = distance;
+            nearest = &biome.sides[k];
           }
         }
 
+        if (nearest == nullptr || nearest->border == nullptr) {
+          continue;
+        }
+
+        auto color = originalColors(pos);
+
+        if (applyBorderEffect(color, pos, *nearest->border, *nearest->other, *biome.atom, minDistance, nearest->field->nearest(pos), originalColors, blurred, random)) {
+          colors(pos) = color;
+        }
       }
     }
 
 
-    Colors colorizeRawTile(const Tile& tile, gf::Random& random, const TilesetData& db, Search search) {
-      Colors colors(tile.pixels.data.getSize());
-      auto& origin = tile.origin;
+  }
 
-      // first pass: base biome color
+  namespace {
 
-      for (auto biome : origin.ids) {
-        if (biome == Void || biome == gf::InvalidId) {
-          continue;
+    class TileColorizer {
+    public:
+      TileColorizer(const TilesetData& db, Search search)
+      : m_db(db)
+      , m_search(search)
+      , m_fields(db.settings.metric)
+      {
+      }
+
+      // the view must be transparent
+      void colorize(ColorsView colors, const Tile& tile, gf::Random& random) {
+        auto& origin = tile.origin;
+
+        // first pass: base biome color
+
+        for (auto biome : origin.ids) {
+          if (biome == Void || biome == gf::InvalidId) {
+            continue;
+          }
+
+          auto& atom = m_db.getAtom(biome, m_search);
+          colorizeAtom(colors, atom, tile, random);
         }
 
-        auto atom = db.getAtom(biome, search);
-        colorizeAtom(colors, atom, tile, random);
+        // second pass: borders
+
+        if (origin.count == 1) {
+          return;
+        }
+
+        if (m_original.data.getSize() != colors.size) {
+          m_original = Colors(colors.size);
+        }
+
+        colors.copyTo(m_original.view());
+        m_fields.reset(tile.pixels);
+        m_blurred.reset(m_original);
+
+        if (origin.count == 2) {
+          const Wang2 *wang = findBorders(m_db, origin.ids[0], origin.ids[1], m_search);
+
+          if (wang != nullptr) {
+            colorizeBorder(colors, m_original, m_blurred, *wang, tile, random, m_db, m_fields);
+          }
+        } else {
+          colorizeBorders(colors, m_original, m_blurred, tile, random, m_db, m_search, m_fields);
+        }
       }
 
-      // second pass: borders
+    private:
+      const TilesetData& m_db;
+      Search m_search;
+      Colors m_original;
+      BlurredColors m_blurred;
+      DistanceFieldCache m_fields;
+    };
 
-      Colors original(colors);
+    gf::Image generateTilesetPreview(const Tileset& tileset, gf::Random& random, const TilesetData& db, Search search) {
+      auto tileSize = db.settings.tile.getTileSize();
+      Colors colors(tileset.tiles.getSize() * (tileSize + 1) - 1);
+      ColorsView view = colors.view();
+      TileColorizer colorizer(db, search);
 
-      if (origin.count == 2) {
-        colorizeBorder(colors, original, db.getWang2(origin.ids[0], origin.ids[1], search), tile, random, db);
-      } else if (origin.count == 3) {
-        colorizeBorder(colors, original, db.getWang2(origin.ids[0], origin.ids[1], search), tile, random, db);
-        colorizeBorder(colors, original, db.getWang2(origin.ids[1], origin.ids[2], search), tile, random, db);
-        colorizeBorder(colors, original, db.getWang2(origin.ids[2], origin.ids[0], search), tile, random, db);
-      } else {
-        assert(origin.count == 1);
+      for (auto pos : tileset.tiles.getPositionRange()) {
+        colorizer.colorize(view.subview(pos * (tileSize + 1), tileSize), tileset(pos), random);
       }
 
-      return colors;
+      return colors.createImage();
     }
 
   }
 
-  Colors colorizeTile(const Tile& tile, gf::Random& random, const TilesetData& db) {
-    return colorizeRawTile(tile, random, db, Search::UseDatabaseOnly).extend(db.settings.tile.spacing);
+  void colorizeTile(ColorsView view, const Tile& tile, gf::Random& random, const TilesetData& db) {
+    int spacing = db.settings.tile.spacing;
+    TileColorizer colorizer(db, Search::UseDatabaseOnly);
+    colorizer.colorize(view.subview(gf::vec(spacing, spacing), db.settings.tile.getTileSize()), tile, random);
+    view.extend(spacing);
   }
 
   gf::Image generateAtomPreview(const Atom& atom, gf::Random& random, const TileSettings& settings) {
     Tile tile = generateFull(settings, atom.id.hash);
     Colors colors(tile.pixels.data.getSize());
-    colorizeAtom(colors, atom, tile, random);
+    colorizeAtom(colors.view(), atom, tile, random);
     return colors.createImage();
   }
 
-  gf::Image generateWang2Preview(const Wang2& wang, gf::Random& random, const TilesetData& db) {
-    Tileset tileset = generateTwoCornersWangTileset(wang, random, db);
-    Colors colors(tileset.tiles.getSize() * (db.settings.tile.getTileSize() + 1) - 1);
+  gf::Image generateWang2Preview(const Tileset& tileset, gf::Random& random, const TilesetData& db) {
+    return generateTilesetPreview(tileset, random, db, Search::IncludeTemporary);
+  }
+
+  gf::Image generateWang3Preview(const Tileset& tileset, gf::Random& random, const TilesetData& db) {
+    return generateTilesetPreview(tileset, random, db, Search::UseDatabaseOnly);
+  }
+
+  TileRandom createTilesetRandom(const TilesetData& db, std::size_t index, RandomStream stream) {
+    uint64_t key = TileRandom::mix(TileRandom::mix(db.settings.seed) ^ (static_cast<uint64_t>(index) << 1 | static_cast<uint64_t>(stream)));
+    return TileRandom(key, getTilesetSalts(db, index));
+  }
 
-    for (auto pos : tileset.tiles.getPositionRange()) {
-      Colors tileColors = colorizeRawTile(tileset(pos), random, db, Search::IncludeTemporary);
-      gf::Vector2i offset = pos * (db.settings.tile.getTileSize() + 1);
-      colors.blit(tileColors, offset);
+  /*
+   * DecoratedTileset
+   */
+
+  std::size_t DecoratedTileset::getCount() const {
+    return atoms.size() + wang2.size() + wang3.size();
+  }
+
+  Tileset& DecoratedTileset::operator[](std::size_t index) {
+    return const_cast<Tileset&>(static_cast<const DecoratedTileset&>(*this)[index]);
+  }
+
+  const Tileset& DecoratedTileset::operator[](std::size_t index) const {
+    if (index < atoms.size()) {
+      return atoms[index];
     }
 
-    return colors.createImage();
+    index -= atoms.size();
+
+    if (index < wang2.size()) {
+      return wang2[index];
+    }
+
+    index -= wang2.size();
+    assert(index < wang3.size());
+    return wang3[index];
+  }
+
+  const char *getAtlasModeName(AtlasMode mode) {
+    switch (mode) {
+      case AtlasMode::Layout:
+        return "layout";
+      case AtlasMode::Deduplicated:
+        return "deduplicated";
+      case AtlasMode::Symmetric:
+        return "symmetric";
+    }
+
+    assert(false);
+    return "layout";
+  }
+
+  std::size_t getTilesetCount(const TilesetData& db) {
+    return db.atoms.size() + db.wang2.size() + db.wang3.size();
   }
 
-  gf::Image generateWang3Preview(const Wang3& wang, gf::Random& random, const TilesetData& db) {
-    Tileset tileset = generateThreeCornersWangTileset(wang, random, db);
-    Colors colors(tileset.tiles.getSize() * (db.settings.tile.getTileSize() + 1) - 1);
+  int getTilesetSize(const TilesetData& db, std::size_t index) {
+    if (index < db.atoms.size()) {
+      return AtomsTilesetSize;
+    }
 
-    for (auto pos : tileset.tiles.getPositionRange()) {
-      Colors tileColors = colorizeRawTile(tileset(pos), random, db, Search::UseDatabaseOnly);
-      gf::Vector2i offset = pos * (db.settings.tile.getTileSize() + 1);
-      colors.blit(tileColors, offset);
+    if (index < db.atoms.size() + db.wang2.size()) {
+      return Wang2TilesetSize;
     }
 
-    return colors.createImage();
+    return Wang3TilesetSize;
   }
 
-  /*
-   * DecoratedTileset
-   */
+  bool isSymmetricTileset(const TilesetData& db, std::size_t index) {
+    if (index < db.atoms.size() || index >= db.atoms.size() + db.wang2.size()) {
+      return false;
+    }
 
-  gf::Vector2i DecoratedTileset::findTerrainPosition(gf::Id id) const {
-    for (auto& tileset : atoms) {
-      for (auto tilePosition : tileset.tiles.getPositionRange()) {
-        auto& tile = tileset(tilePosition);
+    const Wang2& wang = db.wang2[index - db.atoms.size()];
 
-        if (tile.origin.count == 1 && tile.origin.ids[0] == id) {
-          return tileset.position + tilePosition;
-        }
-      }
+    // the fences are tile properties that Tiled does not transform, so a flipped tile would get the fences of
+    // the canonical tile
+
+    if (wang.edge.limit) {
+      return false;
     }
 
-    gf::Log::error("Could not find a terrain for %" PRIx64 "\n", id);
-    return gf::vec(-1, -1);
+    // the stripes and the pavement have a direction, the noise of the other styles and the effects of the
+    // borders do not
+
+    auto isSymmetric = [&db](gf::Id id) {
+      auto style = db.getAtom(id).pigment.style;
+      return style == PigmentStyle::Plain || style == PigmentStyle::Randomize;
+    };
+
+    return isSymmetric(wang.borders[0].id.hash) && isSymmetric(wang.borders[1].id.hash);
   }
 
+  namespace {
 
-  DecoratedTileset generateTilesets(gf::Random& random, const TilesetData& db) {
-    DecoratedTileset tilesets;
+    std::vector<AtomId> getTilesetAtoms(const TilesetData& db, std::size_t index) {
+      if (index < db.atoms.size()) {
+        return { db.atoms[index].id };
+      }
+
+      index -= db.atoms.size();
+
+      if (index < db.wang2.size()) {
+        const Wang2& wang = db.wang2[index];
+        return { wang.borders[0].id, wang.borders[1].id };
+      }
+
+      index -= db.wang2.size();
+      assert(index < db.wang3.size());
+      const Wang3& wang = db.wang3[index];
+      return { wang.ids[0], wang.ids[1], wang.ids[2] };
+    }
 
-    auto features = db.settings.getImageFeatures();
+    bool isSameTileset(const TilesetSalts& salts, const std::vector<AtomId>& atoms) {
+      return std::equal(salts.ids.begin(), salts.ids.end(), atoms.begin(), atoms.end(), [](const AtomId& lhs, const AtomId& rhs) {
+        return lhs.hash == rhs.hash;
+      });
+    }
 
-    gf::Vector2i globalPosition(0, 0);
-    gf::Vector2i tilesetPosition(0, 0);
+  }
 
-    for (auto& atom : db.atoms) {
-      auto tileset = generatePlainTileset(atom.id.hash, db);
-      tileset.position = globalPosition + tilesetPosition * AtomsTilesetSize;
-      tilesets.atoms.push_back(std::move(tileset));
+  std::vector<TileSalt> getTilesetSalts(const TilesetData& db, std::size_t index) {
+    if (db.salts.empty()) {
+      return { };
+    }
 
-      ++tilesetPosition.x;
+    std::vector<AtomId> atoms = getTilesetAtoms(db, index);
 
-      if (tilesetPosition.x == features.atomsPerLine) {
-        tilesetPosition.x = 0;
-        ++tilesetPosition.y;
+    for (auto& salts : db.salts) {
+      if (isSameTileset(salts, atoms)) {
+        return salts.tiles;
       }
     }
 
-    globalPosition.y += features.atomsLineCount * AtomsTilesetSize;
+    return { };
+  }
+
+  bool rerollTile(TilesetData& db, std::size_t index, gf::Vector2i tilePosition) {
+    if (index >= getTilesetCount(db)) {
+      gf::Log::error("Invalid tileset: %zu\n", index);
+      return false;
+    }
+
+    int size = getTilesetSize(db, index);
 
-    // wang2
+    if (tilePosition.x < 0 || tilePosition.x >= size || tilePosition.y < 0 || tilePosition.y >= size) {
+      gf::Log::error("Invalid tile in tileset %zu: %i,%i\n", index, tilePosition.x, tilePosition.y);
+      return false;
+    }
 
-    tilesetPosition = gf::vec(0, 0);
+    std::vector<AtomId> atoms = getTilesetAtoms(db, index);
 
-    for (auto& wang : db.wang2) {
-      auto tileset = generateTwoCornersWangTileset(wang, random, db);
-      tileset.position = globalPosition + tilesetPosition * Wang2TilesetSize;
-      tilesets.wang2.push_back(std::move(tileset));
+    auto it = std::find_if(db.salts.begin(), db.salts.end(), [&atoms](const TilesetSalts& salts) {
+      return isSameTileset(salts, atoms);
+    });
 
-      ++tilesetPosition.x;
+    if (it == db.salts.end()) {
+      db.salts.push_back({ std::move(atoms), { } });
+      it = std::prev(db.salts.end());
+    }
 
-      if (tilesetPosition.x == features.wang2PerLine) {
-        tilesetPosition.x = 0;
-        ++tilesetPosition.y;
+    for (auto& tile : it->tiles) {
+      if (tile.position == tilePosition) {
+        ++tile.salt;
+        return true;
       }
     }
 
-    globalPosition.y += features.wang2LineCount * Wang2TilesetSize;
+    it->tiles.push_back({ tilePosition, 1 });
+    return true;
+  }
 
-    // wang3
+  Tileset generateTileset(const TilesetData& db, std::size_t index, gf::Vector2i position, bool canonical) {
+    // each tile has its own random stream so the result does not depend on the order of the generation
+    TileRandom random = createTilesetRandom(db, index, RandomStream::Generation);
 
-    tilesetPosition = gf::vec(0, 0);
+    auto generate = [&]() {
+      if (index < db.atoms.size()) {
+        return generatePlainTileset(db.atoms[index].id.hash, db);
+      }
 
-    for (auto& wang : db.wang3) {
-      auto tileset = generateThreeCornersWangTileset(wang, random, db);
-      tileset.position = globalPosition + tilesetPosition * Wang3TilesetSize;
-      tilesets.wang3.push_back(std::move(tileset));
+      std::size_t i = index - db.atoms.size();
 
-      ++tilesetPosition.x;
+      if (i < db.wang2.size()) {
+        if (canonical && isSymmetricTileset(db, index)) {
+          return generateCanonicalTwoCornersWangTileset(db.wang2[i], random, db);
+        }
 
-      if (tilesetPosition.x == features.wang3PerLine) {
-        tilesetPosition.x = 0;
-        ++tilesetPosition.y;
+        return generateTwoCornersWangTileset(db.wang2[i], random, db);
       }
+
+      i -= db.wang2.size();
+      assert(i < db.wang3.size());
+      return generateThreeCornersWangTileset(db.wang3[i], random, db);
+    };
+
+    // the pixels of all the tiles of the tileset fit in the first block of the arena
+    int size = getTilesetSize(db, index);
+    gf::Vector2i tileSize = db.settings.tile.getTileSize();
+    auto arena = std::make_shared<TileArena>(static_cast<std::size_t>(size * size) * tileSize.width * tileSize.height);
+    TileArena::Scope scope(*arena);
+
+    Tileset tileset = generate();
+    tileset.arena = std::move(arena);
+    tileset.position = position;
+    return tileset;
+  }
+
+  Tile generateTilesetTile(const TilesetData& db, std::size_t index, gf::Vector2i tilePosition) {
+    gf::Random random = createTilesetRandom(db, index, RandomStream::Generation)(tilePosition);
+
+    if (index < db.atoms.size()) {
+      return generateFull(db.settings.tile, db.atoms[index].id.hash);
+    }
+
+    std::size_t i = index - db.atoms.size();
+
+    if (i < db.wang2.size()) {
+      return generateTwoCornersWangTile(db.wang2[i], tilePosition, random, db);
+    }
+
+    i -= db.wang2.size();
+    assert(i < db.wang3.size());
+    return generateThreeCornersWangTile(db.wang3[i], tilePosition, random, db);
+  }
+
+  void colorizeTileset(ColorsView view, const Tileset& tileset, std::size_t index, const TilesetData& db) {
+    int spacing = db.settings.tile.spacing;
+    gf::Vector2i tileSize = db.settings.tile.getTileSize();
+    gf::Vector2i extendedTileSize = db.settings.tile.getExtendedTileSize();
+
+    TileRandom random = createTilesetRandom(db, index, RandomStream::Colorization);
+    TileColorizer colorizer(db, Search::UseDatabaseOnly);
+
+    for (auto tilePosition : tileset.tiles.getPositionRange()) {
+      ColorsView tileView = view.subview(tilePosition * extendedTileSize, extendedTileSize);
+      gf::Random tileRandom = random(tilePosition);
+      colorizer.colorize(tileView.subview(gf::vec(spacing, spacing), tileSize), tileset(tilePosition), tileRandom);
+      tileView.extend(spacing);
     }
+  }
+
+  void colorizeTilesetTile(ColorsView view, const Tile& tile, std::size_t index, gf::Vector2i tilePosition, const TilesetData& db) {
+    gf::Random random = createTilesetRandom(db, index, RandomStream::Colorization)(tilePosition);
+    colorizeTile(view, tile, random, db);
+  }
+
+  DecoratedTileset generateTilesets(const TilesetData& db, const ExportOptions& options) {
+    DecoratedTileset tilesets;
+    tilesets.atoms.resize(db.atoms.size(), Tileset({ 0, 0 }));
+    tilesets.wang2.resize(db.wang2.size(), Tileset({ 0, 0 }));
+    tilesets.wang3.resize(db.wang3.size(), Tileset({ 0, 0 }));
+
+    AtlasLayout layout = computeAtlasLayout(db);
+    tilesets.imageSize = layout.size;
+
+    parallelFor(tilesets.getCount(), options.threads, [&](std::size_t index) {
+      tilesets[index] = generateTileset(db, index, layout.positions[index]);
+    });
 
     return tilesets;
   }
 
 
-  gf::Image generateTilesetImage(gf::Random& random, const TilesetData& db, const DecoratedTileset& tilesets) {
-    auto features = db.settings.getImageFeatures();
-    Colors mainColors(features.size);
+  gf::Image generateTilesetImage(const TilesetData& db, const DecoratedTileset& tilesets, const ExportOptions& options) {
+    Colors mainColors(tilesets.imageSize);
+    ColorsView atlas = mainColors.view();
+
+    gf::Vector2i extendedTileSize = db.settings.tile.getExtendedTileSize();
 
-    for (auto container : { gf::ref(tilesets.atoms), gf::ref(tilesets.wang2), gf::ref(tilesets.wang3) }) {
-      for (auto& tileset : container.get()) {
-        for (auto tilePosition : tileset.tiles.getPositionRange()) {
-          Colors tileColors = colorizeTile(tileset(tilePosition), random, db);
-          mainColors.blit(tileColors, (tileset.position + tilePosition) * db.settings.tile.getExtendedTileSize());
+    // tilesets are colorized directly in the atlas, they do not overlap so they can be processed in parallel
+
+    parallelFor(tilesets.getCount(), options.threads, [&](std::size_t index) {
+      const Tileset& tileset = tilesets[index];
+      ColorsView view = atlas.subview(tileset.position * extendedTileSize, tileset.tiles.getSize() * extendedTileSize);
+      colorizeTileset(view, tileset, index, db);
+    });
+
+    return mainColors.createImage();
+  }
+
+  namespace {
+
+    void copyToImage(const Colors& colors, gf::Image& image, gf::Vector2i offset) {
+      gf::Vector2i size = colors.data.getSize();
+      std::vector<uint8_t> row(static_cast<std::size_t>(size.width) * 4);
+
+      for (int y = 0; y < size.height; ++y) {
+        convertToRgba32(colors.data.getDataPtr() + static_cast<std::size_t>(y) * size.width, size.width, row.data());
+
+        for (int x = 0; x < size.width; ++x) {
+          const uint8_t *pixel = row.data() + x * 4;
+          image.setPixel(offset + gf::vec(x, y), gf::Color4u(pixel[0], pixel[1], pixel[2], pixel[3]));
         }
       }
     }
 
-    return mainColors.createImage();
+    bool checkAtlasLayout(const gf::Image& image, const AtlasLayout& layout, std::size_t index) {
+      if (index >= layout.positions.size()) {
+        gf::Log::error("Invalid tileset: %zu\n", index);
+        return false;
+      }
+
+      if (image.getSize() != layout.size) {
+        gf::Log::error("The image does not match the layout of the tilesets, it may be outdated\n");
+        return false;
+      }
+
+      return true;
+    }
+
+  }
+
+  bool patchTilesetImage(gf::Image& image, const TilesetData& db, std::size_t index) {
+    AtlasLayout layout = computeAtlasLayout(db);
+
+    if (!checkAtlasLayout(image, layout, index)) {
+      return false;
+    }
+
+    gf::Vector2i extendedTileSize = db.settings.tile.getExtendedTileSize();
+
+    Tileset tileset = generateTileset(db, index, layout.positions[index]);
+    Colors colors(tileset.tiles.getSize() * extendedTileSize);
+    colorizeTileset(colors.view(), tileset, index, db);
+    copyToImage(colors, image, tileset.position * extendedTileSize);
+    return true;
+  }
+
+  bool patchTileImage(gf::Image& image, const TilesetData& db, std::size_t index, gf::Vector2i tilePosition) {
+    AtlasLayout layout = computeAtlasLayout(db);
+
+    if (!checkAtlasLayout(image, layout, index)) {
+      return false;
+    }
+
+    int size = getTilesetSize(db, index);
+
+    if (tilePosition.x < 0 || tilePosition.x >= size || tilePosition.y < 0 || tilePosition.y >= size) {
+      gf::Log::error("Invalid tile in tileset %zu: %i,%i\n", index, tilePosition.x, tilePosition.y);
+      return false;
+    }
+
+    gf::Vector2i extendedTileSize = db.settings.tile.getExtendedTileSize();
+
+    Tile tile = generateTilesetTile(db, index, tilePosition);
+    Colors colors(extendedTileSize);
+    colorizeTilesetTile(colors.view(), tile, index, tilePosition, db);
+    copyToImage(colors, image, (layout.positions[index] + tilePosition) * extendedTileSize);
+    return true;
   }
 
 
@@ -524,36 +1140,102 @@ namespace gftools {
       return stream.str();
     }
 
-  }
+    // index of the terrain of each atom, 0 means no terrain
+    class TerrainIndices {
+    public:
+      TerrainIndices(const TilesetData& db) {
+        m_indices.reserve(db.atoms.size());
 
-  std::string generateTilesetXml(const gf::Path& image, const TilesetData& db, const DecoratedTileset& tilesets) {
-    using namespace std::literals;
+        for (std::size_t i = 0; i < db.atoms.size(); ++i) {
+          m_indices.emplace(db.atoms[i].id.hash, static_cast<int>(i + 1));
+        }
+      }
 
-    std::map<gf::Id, std::size_t> mapping;
+      int operator()(gf::Id id) const {
+        auto it = m_indices.find(id);
+        return it != m_indices.end() ? it->second : 0;
+      }
 
-    for (std::size_t i = 0; i < db.atoms.size(); ++i) {
-      mapping.emplace(db.atoms[i].id.hash, i + 1);
-    }
+    private:
+      std::unordered_map<gf::Id, int> m_indices;
+    };
+
+    // id of each tile of the tilesets in the image, tilesets in order and tiles in row-major order
+    std::vector<int> computeTileIds(const TilesetData& db, const DecoratedTileset& tilesets) {
+      if (!tilesets.tileIds.empty()) {
+        return tilesets.tileIds;
+      }
+
+      gf::Vector2i tileCount = tilesets.imageSize / db.settings.tile.getExtendedTileSize();
+      std::vector<int> tileIds;
 
-    auto getTerrainIndex = [&mapping](gf::Id id) {
-      auto it = mapping.find(id);
+      for (std::size_t index = 0; index < tilesets.getCount(); ++index) {
+        auto& tileset = tilesets[index];
+        auto size = tileset.tiles.getSize();
 
-      if (it != mapping.end()) {
-        return std::to_string(it->second);
+        for (int y = 0; y < size.height; ++y) {
+          for (int x = 0; x < size.width; ++x) {
+            gf::Vector2i position = tileset.position + gf::vec(x, y);
+            tileIds.push_back(position.y * tileCount.width + position.x);
+          }
+        }
       }
 
-      return "0"s;
-    };
+      return tileIds;
+    }
+
+  }
+
+  void writeTilesetXml(std::ostream& os, const gf::Path& image, const TilesetData& db, const DecoratedTileset& tilesets) {
+    TerrainIndices getTerrainIndex(db);
 
-    auto features = db.settings.getImageFeatures();
+    gf::Vector2i imageSize = tilesets.imageSize;
+    gf::Vector2i tileCount = imageSize / db.settings.tile.getExtendedTileSize();
+    std::vector<int> tileIds = computeTileIds(db, tilesets);
 
-    gf::Vector2i tileCount = features.size / db.settings.tile.getExtendedTileSize();
+    // each tile id is described once, with the first tile that has this id
 
-    auto positionToIndex = [tileCount](gf::Vector2i position) {
-      return position.y * tileCount.width + position.x;
+    std::vector<bool> described(tileCount.width * tileCount.height, false);
+
+    auto forEachTile = [&](auto func) {
+      std::size_t next = 0;
+      std::fill(described.begin(), described.end(), false);
+
+      for (std::size_t index = 0; index < tilesets.getCount(); ++index) {
+        auto& tileset = tilesets[index];
+        auto size = tileset.tiles.getSize();
+
+        for (int y = 0; y < size.height; ++y) {
+          for (int x = 0; x < size.width; ++x) {
+            int id = tileIds[next++];
+
+            if (!described[id]) {
+              described[id] = true;
+              func(id, tileset(gf::vec(x, y)));
+            }
+          }
+        }
+      }
     };
 
-    std::ostringstream os;
+    // tile of each terrain, found in one pass as atoms come first so the index of the tile is also the index
+    // in tileIds
+
+    std::vector<int> terrainTiles(db.atoms.size(), -1);
+    std::size_t next = 0;
+
+    for (auto& tileset : tilesets.atoms) {
+      for (auto position : tileset.tiles.getPositionRange()) {
+        auto& tile = tileset(position);
+        int index = tile.origin.count == 1 ? getTerrainIndex(tile.origin.ids[0]) : 0;
+
+        if (index > 0 && terrainTiles[index - 1] == -1) {
+          terrainTiles[index - 1] = tileIds[next];
+        }
+
+        ++next;
+      }
+    }
 
     os << "<?xml " << kv("version", "1.0") << ' ' << kv("encoding", "UTF-8") << "?>\n";
     os << "<tileset " << kv("version", "1.5") << ' ' << kv("name", image.stem().string()) << ' '
@@ -562,80 +1244,116 @@ namespace gftools {
         << kv("spacing", db.settings.tile.spacing * 2) << ' ' << kv("margin", db.settings.tile.spacing)
         << ">\n";
 
+    os << " <properties>\n";
+    os << "  <property " << kv("name", "atlas") << ' ' << kv("value", getAtlasModeName(tilesets.mode)) << "/>\n";
+    os << " </properties>\n";
+
     os << " <transformations " << kv("hflip", 1) << ' ' << kv("vflip", 1) << ' ' << kv("rotate", 1) << ' ' << kv("preferuntransformed", 0) << " />\n";
 
     os << " <image " << kv("source", image.string()) << ' '
-        << kv("width", features.size.width) << ' ' << kv("height", features.size.height)
+        << kv("width", imageSize.width) << ' ' << kv("height", imageSize.height)
         << "/>\n";
 
-    for (auto container : { gf::ref(tilesets.atoms), gf::ref(tilesets.wang2), gf::ref(tilesets.wang3) }) {
-      for (auto& tileset : container.get()) {
-        for (auto tilePosition : tileset.tiles.getPositionRange()) {
-          auto& tile = tileset(tilePosition);
-
-          os << " <tile " << kv("id", positionToIndex(tileset.position + tilePosition));
-
-          if (tile.fences.count > 0) {
-            os << ">\n";
-            os << "  <properties>\n";
-            os << "   <property " << kv("name", "fence_count") << ' ' << kv("value", tile.fences.count) << ' ' << kv("type", "int") << "/>\n";
+    forEachTile([&](int id, const Tile& tile) {
+      os << " <tile " << kv("id", id);
 
-            char name[] = "fence#";
+      if (tile.fences.count > 0) {
+        os << ">\n";
+        os << "  <properties>\n";
+        os << "   <property " << kv("name", "fence_count") << ' ' << kv("value", tile.fences.count) << ' ' << kv("type", "int") << "/>\n";
 
-            for (int i = 0; i < tile.fences.count; ++i) {
-              static constexpr char Sep = ',';
+        char name[] = "fence#";
 
-              name[5] = '0' + i;
-              os << "   <property name=\"" << name << "\" value=\""
-                << tile.fences.segments[i].p0.x << Sep
-                << tile.fences.segments[i].p0.y << Sep
-                << tile.fences.segments[i].p1.x << Sep
-                << tile.fences.segments[i].p1.y << "\" />\n";
-            }
-
-            os << "  </properties>\n";
-            os << " </tile>\n";
-          } else {
-            os << "/>\n";
-          }
+        for (int i = 0; i < tile.fences.count; ++i) {
+          static constexpr char Sep = ',';
 
+          name[5] = '0' + i;
+          os << "   <property name=\"" << name << "\" value=\""
+            << tile.fences.segments[i].p0.x << Sep
+            << tile.fences.segments[i].p0.y << Sep
+            << tile.fences.segments[i].p1.x << Sep
+            << tile.fences.segments[i].p1.y << "\" />\n";
         }
-      }
-    }
 
+        os << "  </properties>\n";
+        os << " </tile>\n";
+      } else {
+        os << "/>\n";
+      }
+    });
 
     os << " <wangsets>\n";
     os << "  <wangset " << kv("name", "Biomes") << ' ' << kv("type", "corner") << ' ' << kv("tile", -1) << ">\n";
 
-    for (auto& atom : db.atoms) {
+    for (std::size_t i = 0; i < db.atoms.size(); ++i) {
+      auto& atom = db.atoms[i];
+
+      if (terrainTiles[i] == -1) {
+        gf::Log::error("Could not find a terrain for %" PRIx64 "\n", atom.id.hash);
+      }
+
       os << "   <wangcolor " << kv("name", atom.id.name) << ' '
           << kv("color", toString(gf::Color::toRgba32(atom.color))) << ' '
-          << kv("tile", positionToIndex(tilesets.findTerrainPosition(atom.id.hash))) << ' '
+          << kv("tile", terrainTiles[i]) << ' '
           << kv("probability", 1)
           << "/>\n";
     }
 
-    for (auto container : { gf::ref(tilesets.atoms), gf::ref(tilesets.wang2), gf::ref(tilesets.wang3) }) {
-      for (auto& tileset : container.get()) {
-        for (auto tilePosition : tileset.tiles.getPositionRange()) {
-          auto& tile = tileset(tilePosition);
-
-          os << "   <wangtile tileid=\"" << positionToIndex(tileset.position + tilePosition) << "\" wangid=\""
-            << "0," << getTerrainIndex(tile.terrain[1]) << ',' // top right
-            << "0," << getTerrainIndex(tile.terrain[3]) << ',' // bottom right
-            << "0," << getTerrainIndex(tile.terrain[2]) << ',' // bottom left
-            << "0," << getTerrainIndex(tile.terrain[0])        // top left
-            << "\"/>\n";
-        }
-      }
-    }
+    forEachTile([&](int id, const Tile& tile) {
+      os << "   <wangtile tileid=\"" << id << "\" wangid=\""
+        << "0," << getTerrainIndex(tile.terrain[1]) << ',' // top right
+        << "0," << getTerrainIndex(tile.terrain[3]) << ',' // bottom right
+        << "0," << getTerrainIndex(tile.terrain[2]) << ',' // bottom left
+        << "0," << getTerrainIndex(tile.terrain[0])        // top left
+        << "\"/>\n";
+    });
 
     os << "  </wangset>\n";
     os << " </wangsets>\n";
 
     os << "</tileset>\n";
+  }
+
+  bool createAutotiler(const TilesetData& db, const DecoratedTileset& tilesets, Autotiler& autotiler) {
+    if (!autotiler.reset(static_cast<int>(db.atoms.size()))) {
+      return false;
+    }
+
+    TerrainIndices getTerrainIndex(db);
+    std::vector<int> tileIds = computeTileIds(db, tilesets);
+
+    auto forEachTile = [&](auto func) {
+      std::size_t next = 0;
+
+      for (std::size_t index = 0; index < tilesets.getCount(); ++index) {
+        auto& tileset = tilesets[index];
+        auto size = tileset.tiles.getSize();
+
+        for (int y = 0; y < size.height; ++y) {
+          for (int x = 0; x < size.width; ++x) {
+            auto& terrain = tileset(gf::vec(x, y)).terrain;
+            func(CornerTerrains{ getTerrainIndex(terrain[0]), getTerrainIndex(terrain[1]), getTerrainIndex(terrain[2]), getTerrainIndex(terrain[3]) }, static_cast<TileId>(tileIds[next++]));
+          }
+        }
+      }
+    };
+
+    forEachTile([&](CornerTerrains corners, TileId id) {
+      autotiler.addTile(corners, id);
+    });
+
+    // the tsx allows every transformation, a combination without a tile of its own (e.g. in a symmetric tileset)
+    // may come from a rotation or a reflection of another tile
+
+    TileTransformations transformations;
+    transformations.hflip = transformations.vflip = transformations.rotate = true;
+
+    forEachTile([&](CornerTerrains corners, TileId id) {
+      autotiler.addTransformedTiles(corners, id, transformations);
+    });
 
-    return os.str();
+    autotiler.computeFallbacks();
+    return true;
   }
 
 }
@@ -21,16 +21,37 @@
 #ifndef TILESET_PROCESS_H
 #define TILESET_PROCESS_H
 
+#include <cstdint>
+#include <iosfwd>
+#include <vector>
+
 #include <gf/Array2D.h>
 #include <gf/Image.h>
+#include <gf/Path.h>
 #include <gf/Random.h>
 #include <gf/Vector.h>
 
+#include "TilesetAutotiler.h"
 #include "TilesetData.h"
 #include "TilesetGeneration.h"
 
 namespace gftools {
 
+  struct ColorsView {
+    gf::Color4f *pixels = nullptr;
+    gf::Vector2i size = gf::vec(0, 0);
+    int stride = 0;
+
+    gf::Color4f& operator()(gf::Vector2i pos) const { return pixels[pos.y * stride + pos.x]; }
+    gf::Color4f *row(int y) const { return pixels + y * stride; }
+
+    ColorsView subview(gf::Vector2i offset, gf::Vector2i subsize) const;
+    void copyTo(ColorsView destination) const;
+
+    // replicate the pixels at the edge of the inner area into the surrounding space
+    void extend(int space) const;
+  };
+
   struct Colors {
     gf::Array2D<gf::Color4f, int> data;
 
@@ -40,31 +61,118 @@ namespace gftools {
     gf::Color4f& operator()(gf::Vector2i pos) { return data(pos); }
     gf::Color4f operator()(gf::Vector2i pos) const { return data(pos); }
 
-    Colors extend(int space) const;
-    void blit(const Colors source, gf::Vector2i offset);
+    ColorsView view();
     gf::Image createImage() const;
   };
 
+  struct DistanceField {
+    static constexpr float Unreachable = 1'000'000.0f;
+
+    gf::Array2D<float, int> distance;
+    gf::Array2D<gf::Vector2i, int> nearest;
+
+    DistanceField() = default;
+    DistanceField(gf::Vector2i size);
+
+    // distance from every pixel to the nearest pixel of the target biome
+    void compute(const Pixels& pixels, gf::Id target, DistanceMetric metric);
+
+  private:
+    void computeManhattan(const Pixels& pixels, gf::Id target);
+    void computeEuclidean(const Pixels& pixels, gf::Id target);
+  };
+
 
-  Colors colorizeTile(const Tile& tile, gf::Random& random, const TilesetData& db);
+  // the view has the extended size of the tile, the spacing is filled with the edges of the tile
+  void colorizeTile(ColorsView view, const Tile& tile, gf::Random& random, const TilesetData& db);
 
   gf::Image generateAtomPreview(const Atom& atom, gf::Random& random, const TileSettings& settings);
-  gf::Image generateWang2Preview(const Wang2& wang, gf::Random& random, const TilesetData& db);
-  gf::Image generateWang3Preview(const Wang3& wang, gf::Random& random, const TilesetData& db);
+  // only the colorization, the geometry of the tileset is generated once and kept while only the colors change
+  gf::Image generateWang2Preview(const Tileset& tileset, gf::Random& random, const TilesetData& db);
+  gf::Image generateWang3Preview(const Tileset& tileset, gf::Random& random, const TilesetData& db);
+
+
+  enum class RandomStream : uint64_t {
+    Generation,
+    Colorization,
+  };
+
+  // independent random streams for the tiles of a tileset, derived from the project seed, the index of the tileset
+  // and the salts of its tiles
+  TileRandom createTilesetRandom(const TilesetData& db, std::size_t index, RandomStream stream);
 
+  struct ExportOptions {
+    unsigned threads = 0; // 0 means one thread per core
+    gf::Path cache; // directory of the cache, empty means no cache
+    bool deduplicate = false; // identical tiles are stored once in the image
+    bool symmetric = false; // only the canonical tiles of the symmetric wang2 tilesets, the image is deduplicated
+    int compression = 6; // zlib level of the image, 0 stores the image for fast iterations
+  };
+
+  // arrangement of the tiles in the exported image, written in the tsx as the "atlas" property of the tileset
+  // so that only an image that follows the layout is patched
+  enum class AtlasMode {
+    Layout, // every tileset at its position in the AtlasLayout
+    Deduplicated, // identical tiles are stored once
+    Symmetric, // only the canonical tiles of the symmetric tilesets, deduplicated
+  };
+
+  const char *getAtlasModeName(AtlasMode mode);
 
   struct DecoratedTileset {
     std::vector<Tileset> atoms;
     std::vector<Tileset> wang2;
     std::vector<Tileset> wang3;
 
-    gf::Vector2i findTerrainPosition(gf::Id id) const;
-  };
+    // the index runs through atoms, then wang2, then wang3
+    std::size_t getCount() const;
+    Tileset& operator[](std::size_t index);
+    const Tileset& operator[](std::size_t index) const;
 
-  DecoratedTileset generateTilesets(gf::Random& random, const TilesetData& db);
+    gf::Vector2i imageSize = gf::vec(0, 0);
+    AtlasMode mode = AtlasMode::Layout;
+    // set when the tiles are deduplicated: the id of each tile in the image, tilesets in order and tiles in
+    // row-major order, otherwise the ids come from the positions
+    std::vector<int> tileIds;
+  };
 
-  gf::Image generateTilesetImage(gf::Random& random, const TilesetData& db, const DecoratedTileset& tilesets);
-  std::string generateTilesetXml(const gf::Path& image, const TilesetData& db, const DecoratedTileset& tilesets);
+  std::size_t getTilesetCount(const TilesetData& db);
+  // number of tiles on each side of the tileset
+  int getTilesetSize(const TilesetData& db, std::size_t index);
+  // a wang2 tileset is symmetric if the colors of its biomes do not depend on the orientation of the tiles, so
+  // that Tiled can flip and rotate the canonical tiles to get the other tiles, see <transformations> in the tsx.
+  // A wang2 with fences is never symmetric as Tiled does not transform the properties of the tiles
+  bool isSymmetricTileset(const TilesetData& db, std::size_t index);
+  // the salts of the tiles of the tileset that were rolled again, see TilesetSalts
+  std::vector<TileSalt> getTilesetSalts(const TilesetData& db, std::size_t index);
+  // change the salt of a tile so that it gets another random, the project must be saved to keep it. False if the
+  // tile does not exist
+  bool rerollTile(TilesetData& db, std::size_t index, gf::Vector2i tilePosition);
+  // the position is the position of the tileset in the atlas, see AtlasLayout. If canonical is set and the
+  // tileset is symmetric, only the canonical tiles and the tiles that are not an exact flip of them are generated,
+  // see generateCanonicalTwoCornersWangTileset
+  Tileset generateTileset(const TilesetData& db, std::size_t index, gf::Vector2i position, bool canonical = false);
+  // the view has the extended size of the tileset
+  void colorizeTileset(ColorsView view, const Tileset& tileset, std::size_t index, const TilesetData& db);
+
+  // a single tile of a tileset, identical to the same tile in the whole tileset
+  Tile generateTilesetTile(const TilesetData& db, std::size_t index, gf::Vector2i tilePosition);
+  // the view has the extended size of the tile
+  void colorizeTilesetTile(ColorsView view, const Tile& tile, std::size_t index, gf::Vector2i tilePosition, const TilesetData& db);
+
+  DecoratedTileset generateTilesets(const TilesetData& db, const ExportOptions& options);
+
+  gf::Image generateTilesetImage(const TilesetData& db, const DecoratedTileset& tilesets, const ExportOptions& options);
+  // regenerate a tileset, or a single tile, in an atlas that was generated without deduplication, only the
+  // rectangle of the tileset or of the tile is modified
+  bool patchTilesetImage(gf::Image& image, const TilesetData& db, std::size_t index);
+  bool patchTileImage(gf::Image& image, const TilesetData& db, std::size_t index, gf::Vector2i tilePosition);
+  // the tsx is written as it is generated
+  void writeTilesetXml(std::ostream& os, const gf::Path& image, const TilesetData& db, const DecoratedTileset& tilesets);
+
+  // the terrains are numbered as in the tsx, works with the tiles of the tilesets even if the pixels are cleared.
+  // False if there are too many atoms for the autotiler.
+  bool createAutotiler(const TilesetData& db, const DecoratedTileset& tilesets, Autotiler& autotiler);
 
 }
 
@@ -18,20 +18,198 @@
  *    misrepresented as being the original software.
  * 3. This notice may not be removed or altered from any source distribution.
  */
+#include <cctype>
 #include <cstdlib>
 #include <cstdio>
+#include <cstring>
+#include <algorithm>
 #include <filesystem>
 #include <fstream>
+#include <string>
+#include <thread>
 
 #include <gf/Log.h>
 
 #include "bits/TilesetApp.h"
+#include "bits/TilesetExport.h"
 
 #include "config.h"
 
+namespace {
+
+  void printUsage() {
+    std::printf("Usage: gf_tileset <file.json>\n");
+    std::printf("       gf_tileset --export <file.json> [--seed <n>] [--out <dir>] [--threads <n>] [--no-cache] [--dedup] [--symmetric] [--compression <0-9>]\n");
+    std::printf("       gf_tileset --patch <file.json> --tileset <n> [--tile <x> <y> [--reroll]] [--seed <n>] [--out <dir>] [--threads <n>] [--compression <0-9>]\n");
+  }
+
+  bool parseNumber(const char *text, unsigned long& value) {
+    // std::stoul skips the spaces and wraps the negative numbers
+    if (!std::isdigit(static_cast<unsigned char>(text[0]))) {
+      return false;
+    }
+
+    try {
+      std::size_t end = 0;
+      value = std::stoul(text, &end);
+      return text[end] == '\0';
+    } catch (std::exception&) {
+      return false;
+    }
+  }
+
+  int runExport(int argc, char *argv[]) {
+    gf::Path path;
+    gf::Path directory;
+    bool hasSeed = false;
+    unsigned long seed = 0;
+    bool useCache = true;
+    bool patch = false;
+    unsigned long tileset = 0;
+    bool hasTileset = false;
+    gf::Vector2i tile = gf::vec(-1, -1);
+    bool hasTile = false;
+    bool reroll = false;
+    gftools::ExportOptions options;
+
+    for (int i = 1; i < argc; ++i) {
+      bool hasValue = i + 1 < argc;
+
+      if (std::strcmp(argv[i], "--export") == 0 && hasValue) {
+        path = argv[++i];
+      } else if (std::strcmp(argv[i], "--patch") == 0 && hasValue) {
+        path = argv[++i];
+        patch = true;
+      } else if (std::strcmp(argv[i], "--tileset") == 0 && hasValue) {
+        if (!parseNumber(argv[++i], tileset)) {
+          std::printf("Invalid tileset: '%s'\n", argv[i]);
+          return EXIT_FAILURE;
+        }
+
+        hasTileset = true;
+      } else if (std::strcmp(argv[i], "--tile") == 0 && i + 2 < argc) {
+        unsigned long x = 0;
+        unsigned long y = 0;
+
+        if (!parseNumber(argv[i + 1], x) || !parseNumber(argv[i + 2], y)) {
+          std::printf("Invalid tile: '%s' '%s'\n", argv[i + 1], argv[i + 2]);
+          return EXIT_FAILURE;
+        }
+
+        tile = gf::vec(static_cast<int>(x), static_cast<int>(y));
+        hasTile = true;
+        i += 2;
+      } else if (std::strcmp(argv[i], "--reroll") == 0) {
+        reroll = true;
+      } else if (std::strcmp(argv[i], "--seed") == 0 && hasValue) {
+        if (!parseNumber(argv[++i], seed)) {
+          std::printf("Invalid seed: '%s'\n", argv[i]);
+          return EXIT_FAILURE;
+        }
+
+        hasSeed = true;
+      } else if (std::strcmp(argv[i], "--out") == 0 && hasValue) {
+        directory = argv[++i];
+      } else if (std::strcmp(argv[i], "--threads") == 0 && hasValue) {
+        unsigned long threads = 0;
+
+        // more threads than that only adds contention
+        unsigned long maxThreads = std::max(std::thread::hardware_concurrency(), 1u) * 4ul;
+
+        if (!parseNumber(argv[++i], threads) || threads > maxThreads) {
+          std::printf("Invalid thread count: '%s'\n", argv[i]);
+          return EXIT_FAILURE;
+        }
+
+        options.threads = static_cast<unsigned>(threads);
+      } else if (std::strcmp(argv[i], "--no-cache") == 0) {
+        useCache = false;
+      } else if (std::strcmp(argv[i], "--compression") == 0 && hasValue) {
+        unsigned long level = 0;
+
+        if (!parseNumber(argv[++i], level) || level > 9) {
+          std::printf("Invalid compression level: '%s'\n", argv[i]);
+          return EXIT_FAILURE;
+        }
+
+        options.compression = static_cast<int>(level);
+      } else if (std::strcmp(argv[i], "--dedup") == 0) {
+        options.deduplicate = true;
+      } else if (std::strcmp(argv[i], "--symmetric") == 0) {
+        options.symmetric = true;
+      } else {
+        printUsage();
+        return EXIT_FAILURE;
+      }
+    }
+
+    // a tile can only be patched, and only a patched tile can be rolled again
+    if (path.empty() || patch != hasTileset || (hasTile && !patch) || (reroll && !hasTile)) {
+      printUsage();
+      return EXIT_FAILURE;
+    }
+
+    if (!std::filesystem::exists(path)) {
+      gf::Log::error("File does not exists: '%s'\n", path.string().c_str());
+      return EXIT_FAILURE;
+    }
+
+    auto data = gftools::TilesetData::load(path);
+
+    // the salt of the tile is saved in the project once the image is patched, with the seed of the project
+    uint32_t projectSeed = data.settings.seed;
+
+    if (reroll && !gftools::rerollTile(data, tileset, tile)) {
+      return EXIT_FAILURE;
+    }
+
+    if (hasSeed) {
+      data.settings.seed = static_cast<uint32_t>(seed);
+    }
+
+    if (useCache) {
+      options.cache = gftools::getCacheDirectory(path);
+    }
+
+    gf::Path basename = path;
+
+    if (!directory.empty()) {
+      std::filesystem::create_directories(directory);
+      basename = directory / path.filename();
+    }
+
+    if (patch) {
+      if (!gftools::patchTileset(data, basename, tileset, tile, options)) {
+        return EXIT_FAILURE;
+      }
+
+      if (reroll) {
+        data.settings.seed = projectSeed;
+        gftools::TilesetData::save(path, data);
+      }
+
+      return EXIT_SUCCESS;
+    }
+
+    gftools::ExportStats stats;
+
+    if (!gftools::exportTileset(data, basename, options, stats)) {
+      return EXIT_FAILURE;
+    }
+
+    gftools::logExportStats(stats);
+    return EXIT_SUCCESS;
+  }
+
+}
+
 int main(int argc, char *argv[]) {
+  if (argc > 1 && (std::strcmp(argv[1], "--export") == 0 || std::strcmp(argv[1], "--patch") == 0)) {
+    return runExport(argc, argv);
+  }
+
   if (argc != 2) {
-    std::printf("Usage: gf_tileset <file.json>\n");
+    printUsage();
     return EXIT_FAILURE;
   }
 